@@ -0,0 +1,471 @@
+#include <math.h>
+
+#include "apu.h"
+#include "emulator.h"
+#include "cpu.h"
+
+#define POWER_ON 0x80
+#define CHANNEL_REGS 5              /* NRx0 ~ NRx4 */
+
+#define HIGH_PASS 0.999f            /* Per sample, about 7 Hz at 48 kHz */
+#define SCALE 64.0f                 /* Loudest mix (4 channels x 15 x 8) to about 30000 */
+
+/* Bits read back as 1, from NR10 to the end of wave RAM */
+static const u8 read_masks[0x30] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,
+    0x00, 0x00, 0x70,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/* Square duty patterns, bit n for step n */
+static const u8 duties[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+#define REG(apu, reg) (apu)->regs[(reg) - R_NR10]
+
+static u8 channel_reg(int channel, int n){
+    return R_NR10 + channel * CHANNEL_REGS + n;
+}
+
+static bool dac_on(const u8* io, int channel){
+    /* io indexed from NR10, the stored registers or the APU's copy */
+    if (channel == 2) return io[R_NR30 - R_NR10] & 0x80;
+    return io[channel * CHANNEL_REGS + 2] & 0xF8;
+}
+
+static void build_kernels(Apu* apu){
+    /* Blackman-windowed sinc with the cutoff a little under 24 kHz, one per sub-sample
+     * offset, each summing to 1 so a step integrates to its full height */
+    const double cutoff = 0.9;
+
+    for (int phase = 0; phase < APU_PHASES; phase ++){
+        double sum = 0;
+
+        for (int k = 0; k < APU_TAPS; k ++){
+            double x = k - (APU_TAPS / 2 - 1) - (double)phase / APU_PHASES;
+            double u = (x + APU_TAPS / 2) / APU_TAPS;
+            double window = u <= 0 || u >= 1 ? 0 : 0.42 - 0.5 * cos(2 * M_PI * u) + 0.08 * cos(4 * M_PI * u);
+            double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+
+            apu->kernels[phase][k] = sinc * window;
+            sum += sinc * window;
+        }
+
+        for (int k = 0; k < APU_TAPS; k ++) apu->kernels[phase][k] /= sum;
+    }
+}
+
+static void add_steps(Apu* apu, uint64_t cycle, int left, int right){
+    uint64_t fixed = ((cycle - apu->origin) * APU_RATE - apu->samples * CPU_CLOCK_HZ) * APU_PHASES / CPU_CLOCK_HZ;
+    const float* kernel = apu->kernels[fixed % APU_PHASES];
+    float* out_left = apu->steps[0] + fixed / APU_PHASES;
+    float* out_right = apu->steps[1] + fixed / APU_PHASES;
+
+    for (int k = 0; k < APU_TAPS; k ++){
+        out_left[k] += kernel[k] * left;
+        out_right[k] += kernel[k] * right;
+    }
+}
+
+static void mix(Apu* apu, uint64_t cycle){
+    /* Output through NR51 (panning) and NR50 (volume), a step when it changes */
+    u8 panning = REG(apu, R_NR51);
+    u8 volume = REG(apu, R_NR50);
+    int left = 0, right = 0;
+
+    for (int c = 0; c < 4; c ++){
+        if (panning & (0x10 << c)) left += apu->channels[c].level;
+        if (panning & (0x01 << c)) right += apu->channels[c].level;
+    }
+
+    left *= ((volume >> 4) & 7) + 1;
+    right *= (volume & 7) + 1;
+
+    if (left == apu->mix[0] && right == apu->mix[1]) return;
+
+    if (apu->audible) add_steps(apu, cycle, left - apu->mix[0], right - apu->mix[1]);
+    apu->mix[0] = left;
+    apu->mix[1] = right;
+}
+
+static u8 channel_level(Apu* apu, int c){
+    ApuChannel* ch = &apu->channels[c];
+    if (!ch->on) return 0;
+
+    switch (c){
+        case 0:
+        case 1: return (duties[REG(apu, channel_reg(c, 1)) >> 6] >> ch->phase) & 1 ? ch->volume : 0;
+        case 2: {
+            static const u8 shifts[4] = { 4, 0, 1, 2 };
+            u8 sample = apu->regs[R_WAVE - R_NR10 + ch->phase / 2];
+
+            sample = ch->phase & 1 ? sample & 0x0F : sample >> 4;
+            return sample >> shifts[(REG(apu, R_NR32) >> 5) & 3];
+        }
+        default: return ch->lfsr & 1 ? 0 : ch->volume;
+    }
+}
+
+static void update(Apu* apu, int c, uint64_t cycle){
+    u8 level = channel_level(apu, c);
+    if (level == apu->channels[c].level) return;
+
+    apu->channels[c].level = level;
+    mix(apu, cycle);
+}
+
+static uint64_t period(Apu* apu, int c){
+    /* Cycles per waveform step */
+    u16 frequency = apu->channels[c].frequency;
+
+    if (c < 2) return (2048 - frequency) * 4;
+    if (c == 2) return (2048 - frequency) * 2;
+
+    u8 nr43 = REG(apu, R_NR43);
+    u8 divisor = nr43 & 7;
+    return (uint64_t)(divisor ? divisor * 16 : 8) << (nr43 >> 4);
+}
+
+static void step(Apu* apu, int c){
+    ApuChannel* ch = &apu->channels[c];
+
+    if (c == 3){
+        u16 bit = (ch->lfsr ^ (ch->lfsr >> 1)) & 1;
+        ch->lfsr = (ch->lfsr >> 1) | (bit << 14);
+        if (REG(apu, R_NR43) & 0x08) ch->lfsr = (ch->lfsr & ~0x40) | (bit << 6);
+    }
+    else ch->phase = (ch->phase + 1) & (c == 2 ? 31 : 7);
+}
+
+static void run_channel(Apu* apu, int c, uint64_t until){
+    /* Edge after edge up to until. Unheard, only the position in the waveform moves on. */
+    ApuChannel* ch = &apu->channels[c];
+    if (!ch->on || ch->next > until) return;
+
+    if (!apu->audible){
+        uint64_t length = period(apu, c);
+        uint64_t steps = (until - ch->next) / length + 1;
+
+        if (c != 3) ch->phase = (ch->phase + steps) & (c == 2 ? 31 : 7);
+        ch->next += steps * length;
+        update(apu, c, until);
+        return;
+    }
+
+    while (ch->next <= until){
+        step(apu, c);
+        update(apu, c, ch->next);
+        ch->next += period(apu, c);
+    }
+}
+
+static u16 sweep_target(Apu* apu){
+    ApuChannel* ch = &apu->channels[0];
+    u8 nr10 = REG(apu, R_NR10);
+    u16 delta = ch->shadow >> (nr10 & 7);
+
+    return nr10 & 0x08 ? ch->shadow - delta : ch->shadow + delta;
+}
+
+static void clock_sequencer(Apu* apu, uint64_t cycle){
+    /* Length at 256 Hz, sweep at 128 Hz, envelopes at 64 Hz */
+    u8 position = (cycle / SEQUENCER_CYCLES) & 7;
+
+    for (int c = 0; c < 4; c ++){
+        ApuChannel* ch = &apu->channels[c];
+        if (!ch->on) continue;
+
+        if (!(position & 1) && ch->length_on && ch->length > 0 && -- ch->length == 0) ch->on = false;
+
+        if (position == 7 && c != 2){
+            u8 envelope = REG(apu, channel_reg(c, 2));
+            u8 pace = envelope & 7;
+
+            if (pace != 0 && -- ch->envelope_timer == 0){
+                ch->envelope_timer = pace;
+                if ((envelope & 0x08) && ch->volume < 15) ch->volume ++;
+                else if (!(envelope & 0x08) && ch->volume > 0) ch->volume --;
+            }
+        }
+
+        if (c == 0 && (position & 3) == 2 && -- ch->sweep_timer == 0){
+            u8 pace = (REG(apu, R_NR10) >> 4) & 7;
+            ch->sweep_timer = pace ? pace : 8;
+
+            if (ch->sweep_on && pace != 0){
+                u16 target = sweep_target(apu);
+
+                if (target > 2047) ch->on = false;
+                else if (REG(apu, R_NR10) & 7){
+                    ch->frequency = ch->shadow = target;
+                    if (sweep_target(apu) > 2047) ch->on = false;
+                }
+            }
+        }
+
+        update(apu, c, cycle);
+    }
+}
+
+static void advance(Apu* apu, uint64_t until){
+    /* Channels and the frame sequencer from apu->time to until */
+    for (;;){
+        uint64_t tick = (apu->time / SEQUENCER_CYCLES + 1) * SEQUENCER_CYCLES;
+        if (tick > until) break;
+
+        for (int c = 0; c < 4; c ++) run_channel(apu, c, tick);
+        apu->time = tick;
+        clock_sequencer(apu, tick);
+    }
+
+    for (int c = 0; c < 4; c ++) run_channel(apu, c, until);
+    apu->time = until;
+}
+
+static void trigger(Apu* apu, int c, uint64_t cycle){
+    ApuChannel* ch = &apu->channels[c];
+
+    ch->on = dac_on(apu->regs, c);
+    if (ch->length == 0) ch->length = c == 2 ? 256 : 64;
+    ch->volume = REG(apu, channel_reg(c, 2)) >> 4;
+    ch->envelope_timer = REG(apu, channel_reg(c, 2)) & 7;
+    ch->next = cycle + period(apu, c);
+
+    if (c == 2) ch->phase = 0;
+    if (c == 3) ch->lfsr = 0x7FFF;
+
+    if (c == 0){
+        u8 nr10 = REG(apu, R_NR10);
+        u8 pace = (nr10 >> 4) & 7;
+
+        ch->shadow = ch->frequency;
+        ch->sweep_timer = pace ? pace : 8;
+        ch->sweep_on = pace != 0 || (nr10 & 7) != 0;
+        if ((nr10 & 7) && sweep_target(apu) > 2047) ch->on = false;
+    }
+}
+
+static void apply(Apu* apu, u8 reg, u8 value, uint64_t cycle){
+    /* One logged write, at cycle, to the APU's side of the registers */
+    if (reg == R_NR52){
+        REG(apu, R_NR52) = value;
+        if (!(value & POWER_ON)){
+            memset(apu->regs, 0, R_NR52 - R_NR10);
+            for (int c = 0; c < 4; c ++) apu->channels[c].on = false;
+        }
+    }
+    else if (reg < R_NR50){
+        int c = (reg - R_NR10) / CHANNEL_REGS;
+        int n = (reg - R_NR10) % CHANNEL_REGS;
+        ApuChannel* ch = &apu->channels[c];
+
+        REG(apu, reg) = value;
+        switch (n){
+            case 0: if (c == 2 && !(value & 0x80)) ch->on = false; break;
+            case 1: ch->length = c == 2 ? 256 - value : 64 - (value & 63); break;
+            case 2: if (c != 2 && !dac_on(apu->regs, c)) ch->on = false; break;
+            case 3: if (c != 3) ch->frequency = (ch->frequency & 0x700) | value; break;
+            case 4: {
+                if (c != 3) ch->frequency = (ch->frequency & 0xFF) | ((value & 7) << 8);
+                ch->length_on = value & 0x40;
+                if (value & 0x80) trigger(apu, c, cycle);
+                break;
+            }
+        }
+    }
+    else REG(apu, reg) = value;
+
+    for (int c = 0; c < 4; c ++) update(apu, c, cycle);
+    mix(apu, cycle);
+}
+
+static void emit(Emulator* emu){
+    /* Every sample no step to come can reach any more, to the hook */
+    Apu* apu = &emu->apu;
+    uint64_t fixed = ((apu->time - apu->origin) * APU_RATE - apu->samples * CPU_CLOCK_HZ) * APU_PHASES / CPU_CLOCK_HZ;
+    size_t count = fixed / APU_PHASES;
+    if (count == 0) return;
+
+    for (int side = 0; side < 2; side ++){
+        float* steps = apu->steps[side];
+        float level = apu->level[side], dc = apu->dc[side];
+
+        for (size_t i = 0; i < count; i ++){
+            level += steps[i];
+            dc = dc * HIGH_PASS + level * (1 - HIGH_PASS);
+
+            float value = (level - dc) * SCALE;
+            apu->out[i * 2 + side] = value > 32767 ? 32767 : value < -32768 ? -32768 : (int16_t)value;
+        }
+
+        apu->level[side] = level;
+        apu->dc[side] = dc;
+        memmove(steps, steps + count, (APU_BUFFER + APU_TAPS - count) * sizeof(float));
+        memset(steps + APU_BUFFER + APU_TAPS - count, 0, count * sizeof(float));
+    }
+
+    apu->samples += count;
+    apu->produced += count;
+    if (emu->audio_hook != NULL) emu->audio_hook(emu, apu->out, count);
+}
+
+static void run(Emulator* emu, uint64_t until){
+    /* A frame at most between two emits, so the buffer never overflows */
+    Apu* apu = &emu->apu;
+
+    while (apu->time < until){
+        uint64_t end = until - apu->time > CYCLES_PER_FRAME ? apu->time + CYCLES_PER_FRAME : until;
+
+        advance(apu, end);
+        if (apu->audible) emit(emu);
+    }
+}
+
+static void rebase(Apu* apu){
+    /* Starts the sample time line over at apu->time, with the output already at its level (the
+     * DC estimate carries over, so skipped frames do not leave a click) */
+    apu->origin = apu->time;
+    apu->samples = 0;
+    memset(apu->steps, 0, sizeof(apu->steps));
+
+    for (int side = 0; side < 2; side ++) apu->level[side] = apu->mix[side];
+}
+
+static void sync_until(Emulator* emu, uint64_t until){
+    /* Replays the log up to until and runs the channels there, later writes stay logged */
+    Apu* apu = &emu->apu;
+    bool audible = emu->ppu.rendering;
+    size_t replayed = 0;
+
+    if (audible && !apu->audible){
+        apu->audible = true;
+        rebase(apu);
+    }
+    apu->audible = audible;
+
+    while (replayed < apu->logged && apu->log[replayed].cycle <= until){
+        ApuWrite* write = &apu->log[replayed ++];
+        run(emu, write->cycle);
+        apply(apu, write->reg, write->value, write->cycle);
+    }
+
+    apu->writes += replayed;
+    apu->logged -= replayed;
+    memmove(apu->log, apu->log + replayed, apu->logged * sizeof(ApuWrite));
+    run(emu, until);
+}
+
+static void sync(Emulator* emu){
+    /* Replays the log and runs the channels up to now */
+    sync_until(emu, emu->cycles);
+}
+
+void apu_start(Emulator* emu){
+    /* Audio on (or a state was loaded): the channels start silent from the registers as they
+     * are, the next trigger makes them heard */
+    Apu* apu = &emu->apu;
+
+    memset(apu->channels, 0, sizeof(apu->channels));
+    memcpy(apu->regs, emu->IO + R_NR10, sizeof(apu->regs));
+    apu->logged = 0;
+    apu->time = emu->cycles;
+    apu->mix[0] = apu->mix[1] = 0;
+    apu->dc[0] = apu->dc[1] = 0;
+    apu->audible = false;
+    build_kernels(apu);
+    rebase(apu);
+}
+
+void apu_write(Emulator* emu, u8 reg, u8 byte){
+    Apu* apu = &emu->apu;
+    bool power = emu->IO[R_NR52] & POWER_ON;
+
+    /* Only NR52 and wave RAM can be written while powered off */
+    if (!power && reg < R_NR52) return;
+
+    if (reg == R_NR52){
+        emu->IO[R_NR52] = (byte & POWER_ON) | (byte & POWER_ON ? emu->IO[R_NR52] & 0x0F : 0);
+        if (!(byte & POWER_ON)) memset(emu->IO + R_NR10, 0, R_NR52 - R_NR10);
+    }
+    else {
+        emu->IO[reg] = byte;
+
+        /* The channel flags of NR52, as far as writes tell */
+        if (reg < R_NR50){
+            int c = (reg - R_NR10) / CHANNEL_REGS;
+            int n = (reg - R_NR10) % CHANNEL_REGS;
+
+            if (n == 4 && (byte & 0x80) && dac_on(emu->IO + R_NR10, c)) emu->IO[R_NR52] |= 1 << c;
+            if ((n == 2 || (c == 2 && n == 0)) && !dac_on(emu->IO + R_NR10, c)) emu->IO[R_NR52] &= ~(1 << c);
+        }
+    }
+
+    if (!apu->enabled) return;
+
+    if (apu->logged == APU_LOG_SIZE) sync(emu);
+    apu->log[apu->logged ++] = (ApuWrite){ emu->cycles, reg, byte };
+}
+
+u8 apu_read(Emulator* emu, u8 reg){
+    if (reg == R_NR52){
+        u8 status = emu->IO[R_NR52] & 0x0F;
+
+        /* With audio on the channels know when their length ran out */
+        if (emu->apu.enabled){
+            sync(emu);
+            status = 0;
+            for (int c = 0; c < 4; c ++) status |= emu->apu.channels[c].on << c;
+        }
+
+        return (emu->IO[R_NR52] & POWER_ON) | 0x70 | status;
+    }
+
+    return emu->IO[reg] | read_masks[reg - R_NR10];
+}
+
+static uint64_t next_clock(uint64_t after, u8 mask, u8 match){
+    /* First frame sequencer tick after after whose step (0 ~ 7) has (step & mask) == match */
+    uint64_t tick = (after / SEQUENCER_CYCLES + 1) * SEQUENCER_CYCLES;
+
+    while (((tick / SEQUENCER_CYCLES) & mask) != match) tick += SEQUENCER_CYCLES;
+    return tick;
+}
+
+uint64_t apu_next_change(Emulator* emu, uint64_t from){
+    /* First cycle after from at which NR52 may read differently without a write: a length
+     * counter running out, or the sweep overflowing channel 1. UINT64_MAX when neither can
+     * happen, or with audio off, where NR52 only changes on writes. */
+    Apu* apu = &emu->apu;
+    if (!apu->enabled) return UINT64_MAX;
+
+    /* The channels as from saw them. Past from they may be already, when NR52 was read since:
+     * the state then is the one that read saw. */
+    sync_until(emu, from > apu->time ? from : apu->time);
+    uint64_t change = UINT64_MAX;
+
+    for (int c = 0; c < 4; c ++){
+        ApuChannel* ch = &apu->channels[c];
+        if (!ch->on || !ch->length_on || ch->length == 0) continue;
+
+        /* Length is clocked on the even steps, every other tick */
+        uint64_t off = next_clock(apu->time, 1, 0) + (uint64_t)(ch->length - 1) * 2 * SEQUENCER_CYCLES;
+        if (off < change) change = off;
+    }
+
+    ApuChannel* sweep = &apu->channels[0];
+    if (sweep->on && sweep->sweep_on && (REG(apu, R_NR10) & 0x70)){
+        /* Steps 2 and 6; sweep_timer counts down to the one that may turn it off */
+        uint64_t at = next_clock(apu->time, 3, 2) + (uint64_t)(sweep->sweep_timer > 0 ? sweep->sweep_timer - 1 : 0) * 4 * SEQUENCER_CYCLES;
+        if (at < change) change = at;
+    }
+
+    return change > from ? change : from + 1;
+}
+
+void apu_flush(Emulator* emu){
+    /* Synthesises everything up to now, called at every VBlank and by owners before they
+     * stop */
+    if (emu->apu.enabled) sync(emu);
+}
@@ -0,0 +1,85 @@
+#ifndef gbc_apu
+#define gbc_apu
+
+#include "common.h"
+
+/* Sound. Nothing here runs per cycle. A register write is stored in IO like any other and,
+ * while audio is on, logged with its cycle. Once per frame (at VBlank), when the log is full
+ * or when NR52 is read, the log is replayed: between two writes every channel jumps from one
+ * edge of its waveform to the next, and every change of the mixed output goes into a 48 kHz
+ * buffer as a band-limited step, a windowed sinc spread over APU_TAPS samples at one of
+ * APU_PHASES sub-sample offsets. The resampling is done by placing the steps, so a single pass
+ * over the buffer (integrate, remove DC, scale) gives the 16-bit stereo samples handed to the
+ * audio hook.
+ *
+ * With audio off (the default) a write costs storing the value, and NR52 only follows which
+ * channels were triggered and which DACs were turned off. Audio follows the renderer (see
+ * ppu.h): frames that are not drawn are replayed without being synthesised, so turbo keeps
+ * one frame of sound in N and headless none. */
+
+#define APU_RATE 48000
+#define APU_TAPS 16
+#define APU_PHASES 32
+#define APU_BUFFER 2048             /* Samples per side, a little over two frames */
+#define APU_LOG_SIZE 1024
+
+#define SEQUENCER_CYCLES 8192       /* Frame sequencer, 512 Hz */
+
+struct Emulator;
+
+typedef struct {
+    uint64_t cycle;
+    u8 reg;
+    u8 value;
+} ApuWrite;
+
+typedef struct {
+    bool on;                /* Triggered, DAC on and length not run out */
+    bool length_on;
+    u16 length;             /* Length clocks left */
+    u16 frequency;
+    u8 level;               /* Output, 0 ~ 15 */
+    u8 phase;               /* Duty step or wave sample */
+    uint64_t next;          /* Cycle of the next waveform step */
+
+    u8 volume;
+    u8 envelope_timer;
+
+    u16 shadow;             /* Sweep, channel 1 only */
+    u8 sweep_timer;
+    bool sweep_on;
+
+    u16 lfsr;               /* Noise, channel 4 only */
+} ApuChannel;
+
+typedef struct {
+    bool enabled;
+    bool audible;           /* Steps go into the buffer (the frame is drawn) */
+
+    ApuWrite log[APU_LOG_SIZE];
+    size_t logged;
+
+    u8 regs[0x30];          /* 0xFF10 ~ 0xFF3F as the channels have seen it so far */
+    ApuChannel channels[4];
+    uint64_t time;          /* Cycle the channels have been run to */
+    int mix[2];             /* Left and right output */
+
+    uint64_t origin;        /* Cycle of the first sample of the buffer's time line */
+    uint64_t samples;       /* Samples handed out since origin */
+    float kernels[APU_PHASES][APU_TAPS];
+    float steps[2][APU_BUFFER + APU_TAPS];
+    float level[2];         /* Integrated steps */
+    float dc[2];            /* Their running average, taken out of the output */
+    int16_t out[APU_BUFFER * 2];
+
+    uint64_t writes;        /* Register writes replayed */
+    uint64_t produced;      /* Samples handed to the hook */
+} Apu;
+
+void apu_start(struct Emulator* emu);
+void apu_write(struct Emulator* emu, u8 reg, u8 byte);
+u8 apu_read(struct Emulator* emu, u8 reg);
+uint64_t apu_next_change(struct Emulator* emu, uint64_t from);
+void apu_flush(struct Emulator* emu);
+
+#endif
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/sysinfo.h>
+#endif
+
+#include "cpu.h"
+
+/* Headless batch runner: runs every job of a manifest on a pool of worker threads, one
+ * independent Emulator per job, and writes a JSON summary.
+ *
+ * Manifest, one job per line, '#' starts a comment:
+ *     <rom> <cycles> [noidle] [expected serial output]
+ * The rest of the line after the cycle budget is the text the ROM has to send over the link
+ * port for the job to pass (for example "Passed" for Blargg's tests). Without it, a job passes
+ * when it spends its whole budget without the CPU stopping. "noidle" turns idle loop skipping
+ * (see idle.h) off for the job. Nothing looks at the screen, so jobs run without rendering.
+ * A manifest without jobs is an empty run: an empty summary, and it passes. */
+
+#define MAX_LINE 1024
+#define SERIAL_LIMIT (1 << 20)    /* Serial output kept per job */
+
+typedef enum {
+    JOB_PASS,
+    JOB_FAIL,
+    JOB_ERROR
+} job_status;
+
+static const char* status_names[] = { "pass", "fail", "error" };
+
+/* Every distinct ROM path is mapped once, before the workers start, and shared read-only by
+ * all the jobs that run it. */
+typedef struct {
+    char* path;
+    uint8_t* data;      /* NULL when the file could not be mapped */
+    size_t size;
+} Rom;
+
+typedef struct {
+    /* From the manifest */
+    char* rom;
+    Rom* image;
+    uint64_t cycles;
+    char* expect;       /* NULL when not checking serial output */
+    bool no_idle;
+    int line;
+
+    /* Filled in by the worker */
+    job_status status;
+    char error[96];     /* Why the job could not run, or why the CPU stopped */
+    bool stopped;       /* The CPU stopped before the budget was spent */
+    uint64_t cycles_run;
+    uint64_t instructions;
+    uint64_t idle_cycles;   /* Skipped in idle loops */
+    double startup;     /* Parsing the header and creating the instance */
+    double seconds;
+    char* serial;
+    size_t serial_length;
+    size_t serial_capacity;
+} Job;
+
+typedef struct {
+    Rom* roms;
+    size_t rom_count;
+    Job* jobs;
+    size_t count;
+    size_t next;        /* Next job to hand out */
+    pthread_mutex_t lock;
+} Pool;
+
+static void usage(const char* name){
+    printf("Usage: %s [options] <manifest>\n", name);
+    printf("  -j <count>  worker threads (default: one per core)\n");
+    printf("  -o <file>   write the JSON summary to <file> instead of stdout\n");
+}
+
+static void collect_serial(Emulator* emu, u8 byte){
+    Job* job = (Job*)emu->user;
+
+    if (job->serial_length + 1 >= job->serial_capacity){
+        if (job->serial_capacity >= SERIAL_LIMIT) return;
+
+        size_t capacity = job->serial_capacity ? job->serial_capacity * 2 : 256;
+        char* serial = (char*)realloc(job->serial, capacity);
+        if (serial == NULL) return;
+
+        job->serial = serial;
+        job->serial_capacity = capacity;
+    }
+
+    job->serial[job->serial_length ++] = byte;
+    job->serial[job->serial_length] = '\0';
+}
+
+static void collect_log(Emulator* emu, log_level level, const char* message){
+    /* Keeps the first fatal message, warnings are dropped */
+    Job* job = (Job*)emu->user;
+    if (level == LOG_FATAL && job->error[0] == '\0') snprintf(job->error, sizeof(job->error), "%s", message);
+}
+
+static double elapsed(struct timespec* from, struct timespec* to){
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void run_job(Job* job){
+    if (job->image->data == NULL){
+        job->status = JOB_ERROR;
+        snprintf(job->error, sizeof(job->error), "cannot read ROM");
+        return;
+    }
+
+    struct timespec loading, started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &loading);
+
+    Cartridge cart;
+    initCartridge(&cart, job->image->data, job->image->size);
+
+    Emulator* emu = createEmulator(&cart);
+    if (emu == NULL){
+        job->status = JOB_ERROR;
+        snprintf(job->error, sizeof(job->error), "out of memory");
+        return;
+    }
+
+    emu->serial_hook = collect_serial;
+    emu->log_hook = collect_log;
+    emu->user = job;
+    emu->idle.enabled = !job->no_idle;
+    emulator_set_render(emu, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    emu_error error = emulator_run(emu, job->cycles);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    job->startup = elapsed(&loading, &started);
+    job->seconds = elapsed(&started, &finished);
+    job->cycles_run = emu->cycles;
+    job->instructions = emu->instructions;
+    job->idle_cycles = emu->idle.skipped_cycles;
+    job->stopped = error != EMU_OK;
+
+    if (job->expect != NULL) job->status = job->serial != NULL && strstr(job->serial, job->expect) ? JOB_PASS : JOB_FAIL;
+    else job->status = job->stopped ? JOB_FAIL : JOB_PASS;
+
+    destroyEmulator(emu);
+}
+
+static void* worker(void* arg){
+    Pool* pool = (Pool*)arg;
+
+    for (;;){
+        pthread_mutex_lock(&pool->lock);
+        size_t index = pool->next ++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (index >= pool->count) return NULL;
+        run_job(&pool->jobs[index]);
+    }
+}
+
+static char* trim(char* text){
+    while (*text == ' ' || *text == '\t') text ++;
+
+    char* end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) end --;
+    *end = '\0';
+
+    return text;
+}
+
+static void free_jobs(Job* jobs, size_t count){
+    for (size_t i = 0; i < count; i ++){
+        free(jobs[i].rom);
+        free(jobs[i].expect);
+    }
+
+    free(jobs);
+}
+
+static bool read_manifest(const char* path, Job** out, size_t* count){
+    /* Returns false (after printing why) when the manifest cannot be read or has a bad line.
+     * *out stays NULL when there is no job. */
+    FILE* file = fopen(path, "r");
+    if (file == NULL){
+        printf("Cannot open manifest.\n");
+        return false;
+    }
+
+    Job* jobs = NULL;
+    size_t capacity = 0;
+    char buffer[MAX_LINE];
+    int line = 0;
+
+    *out = NULL;
+    *count = 0;
+
+    while (fgets(buffer, sizeof(buffer), file) != NULL){
+        line ++;
+
+        char* comment = strchr(buffer, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char* text = trim(buffer);
+        if (*text == '\0') continue;
+
+        char* rom = text;
+        while (*text != '\0' && *text != ' ' && *text != '\t') text ++;
+        if (*text != '\0') *text ++ = '\0';
+
+        char* budget = trim(text);
+        char* end;
+        uint64_t cycles = strtoull(budget, &end, 0);
+        if (end == budget || cycles == 0){
+            printf("%s:%d: expected a cycle budget after the ROM path.\n", path, line);
+            free_jobs(jobs, *count);
+            fclose(file);
+            return false;
+        }
+
+        char* expect = trim(end);
+        bool no_idle = strncmp(expect, "noidle", 6) == 0 && (expect[6] == '\0' || expect[6] == ' ' || expect[6] == '\t');
+        if (no_idle) expect = trim(expect + 6);
+
+        if (*count == capacity){
+            size_t grown = capacity ? capacity * 2 : 64;
+            Job* more = (Job*)realloc(jobs, grown * sizeof(Job));
+            if (more == NULL){
+                printf("Cannot allocate the job list.\n");
+                free_jobs(jobs, *count);
+                fclose(file);
+                return false;
+            }
+
+            jobs = more;
+            capacity = grown;
+        }
+
+        Job* job = &jobs[(*count) ++];
+        memset(job, 0, sizeof(Job));
+        job->rom = strdup(rom);
+        job->cycles = cycles;
+        job->expect = *expect != '\0' ? strdup(expect) : NULL;
+        job->no_idle = no_idle;
+        job->line = line;
+    }
+
+    fclose(file);
+    *out = jobs;
+    return true;
+}
+
+static void map_roms(Pool* pool){
+    pool->roms = (Rom*)malloc(pool->count * sizeof(Rom));
+    pool->rom_count = 0;
+
+    for (size_t i = 0; i < pool->count; i ++){
+        Job* job = &pool->jobs[i];
+        Rom* rom = NULL;
+
+        for (size_t r = 0; r < pool->rom_count && rom == NULL; r ++)
+            if (strcmp(pool->roms[r].path, job->rom) == 0) rom = &pool->roms[r];
+
+        if (rom == NULL){
+            rom = &pool->roms[pool->rom_count ++];
+            rom->path = job->rom;
+            rom->data = mapRom(job->rom, &rom->size);
+        }
+
+        job->image = rom;
+    }
+}
+
+static void write_json_string(FILE* out, const char* text, size_t length){
+    fputc('"', out);
+
+    for (size_t i = 0; i < length; i ++){
+        u8 c = text[i];
+
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c == '\n') fputs("\\n", out);
+        else if (c < 0x20 || c >= 0x7f) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+
+    fputc('"', out);
+}
+
+static void write_summary(FILE* out, Job* jobs, size_t count, int threads, double seconds){
+    size_t totals[3] = { 0 };
+    double startup = 0;
+
+    for (size_t i = 0; i < count; i ++){
+        totals[jobs[i].status] ++;
+        startup += jobs[i].startup;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "{\n  \"jobs\": %zu, \"passed\": %zu, \"failed\": %zu, \"errors\": %zu,\n",
+        count, totals[JOB_PASS], totals[JOB_FAIL], totals[JOB_ERROR]);
+    fprintf(out, "  \"threads\": %d, \"seconds\": %.3f, \"startup_per_job\": %.6f, \"peak_rss_kb\": %ld,\n  \"results\": [\n",
+        threads, seconds, count ? startup / count : 0.0, usage.ru_maxrss);
+
+    for (size_t i = 0; i < count; i ++){
+        Job* job = &jobs[i];
+
+        fprintf(out, "    {\"line\": %d, \"rom\": ", job->line);
+        write_json_string(out, job->rom, strlen(job->rom));
+        fprintf(out, ", \"status\": \"%s\"", status_names[job->status]);
+
+        if (job->error[0] != '\0'){
+            fprintf(out, ", \"error\": ");
+            write_json_string(out, job->error, strlen(job->error));
+        }
+
+        if (job->status != JOB_ERROR){
+            fprintf(out, ", \"cycles\": %llu, \"budget\": %llu, \"instructions\": %llu, \"idle_cycles\": %llu, \"stopped\": %s, \"startup\": %.6f, \"seconds\": %.3f, \"serial\": ",
+                (unsigned long long)job->cycles_run, (unsigned long long)job->cycles,
+                (unsigned long long)job->instructions, (unsigned long long)job->idle_cycles, job->stopped ? "true" : "false", job->startup, job->seconds);
+            write_json_string(out, job->serial ? job->serial : "", job->serial_length);
+        }
+
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+static int default_threads(void){
+    /* unistd.h is out, its read() clashes with the one in cpu.h */
+#ifdef __linux__
+    int cores = get_nprocs();
+    if (cores > 0) return cores;
+#endif
+    return 4;
+}
+
+int main(int argc, char* argv[]){
+    char* manifestPath = NULL;
+    char* outputPath = NULL;
+    int threads = default_threads();
+
+    for (int i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++ i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) outputPath = argv[++ i];
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            exit(1);
+        }
+        else manifestPath = argv[i];
+    }
+
+    if (manifestPath == NULL || threads < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    Pool pool;
+    if (!read_manifest(manifestPath, &pool.jobs, &pool.count)) exit(10);
+    pool.next = 0;
+
+    map_roms(&pool);
+
+    if ((size_t)threads > pool.count) threads = pool.count > 0 ? pool.count : 1;
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_t* workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    for (int i = 0; i < threads; i ++) pthread_create(&workers[i], NULL, worker, &pool);
+    for (int i = 0; i < threads; i ++) pthread_join(workers[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = elapsed(&started, &finished);
+
+    FILE* out = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+    if (out == NULL) {
+        printf("Cannot write summary file.\n");
+        exit(11);
+    }
+
+    write_summary(out, pool.jobs, pool.count, threads, seconds);
+    if (out != stdout) fclose(out);
+
+    bool passed = true;
+    for (size_t i = 0; i < pool.count; i ++){
+        passed &= pool.jobs[i].status == JOB_PASS;
+
+        free(pool.jobs[i].rom);
+        free(pool.jobs[i].expect);
+        free(pool.jobs[i].serial);
+    }
+
+    for (size_t r = 0; r < pool.rom_count; r ++) unmapRom(pool.roms[r].data, pool.roms[r].size);
+
+    free(pool.roms);
+    free(pool.jobs);
+    free(workers);
+    pthread_mutex_destroy(&pool.lock);
+
+    return passed ? 0 : 2;
+}
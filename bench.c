@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* The bus and ALU helpers are static, so the benchmark is built as one translation unit with
+ * the interpreter core instead of linking cpu.o. */
+#include "cpu.c"
+
+/* Host-side benchmarks, written as JSON so results can be compared commit over commit.
+ *
+ *   micro  the read / write bus, every ALU helper and the dispatch loop on synthetic opcode
+ *          streams, each as nanoseconds per operation
+ *   macro  whole ROMs run for a fixed cycle budget, as emulated MHz, instructions per second
+ *          and frames per second, rendering every frame, then headless, then rendering with
+ *          sound synthesised. A ROM that stops early only gets its counts, no rates
+ *   render the frames the same ROMs show (recorded headless, then replayed), then a
+ *          synthetic pattern of ROM bytes as tile data with one tile rewritten per frame,
+ *          as microseconds per frame with the decoded tile cache on and off
+ *
+ * Every number is the best of BENCH_REPEATS runs. The format only ever gains keys, except
+ * that format 2 leaves the rates out of stopped macro runs. */
+
+#define BENCH_FORMAT 2
+#define BENCH_REPEATS 3
+#define DEFAULT_MICRO_OPERATIONS 20000000
+#define DEFAULT_MACRO_CYCLES (600ULL * CYCLES_PER_FRAME)
+#define DEFAULT_RENDER_FRAMES 2000
+
+#define STREAM_START 0x150
+#define STREAM_END 0x7ffd    /* Room for the JP back to the start */
+
+static volatile uint64_t sink;
+
+static double now(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void quiet_serial(Emulator* emu, u8 byte){
+    (void)emu;
+    (void)byte;
+}
+
+static void quiet_log(Emulator* emu, log_level level, const char* message){
+    (void)emu;
+    (void)level;
+    (void)message;
+}
+
+static Emulator* quiet_emulator(Cartridge* cart){
+    Emulator* emu = createEmulator(cart);
+    if (emu != NULL) {
+        emu->serial_hook = quiet_serial;
+        emu->log_hook = quiet_log;
+    }
+
+    return emu;
+}
+
+/* Micro benchmarks: every one runs n operations on a ready instance, each depending on the
+ * one before so the compiler cannot drop or batch them. */
+
+typedef uint64_t (*micro_body)(Emulator* emu, uint64_t n);
+
+static uint64_t read_rom(Emulator* emu, uint64_t n){
+    u8 value = 0;
+    for (uint64_t i = 0; i < n; i ++) value += read(emu, (i + value) & 0x3fff);
+    return value;
+}
+
+static uint64_t read_wram(Emulator* emu, uint64_t n){
+    u8 value = 0;
+    for (uint64_t i = 0; i < n; i ++) value += read(emu, 0xc000 + ((i + value) & 0x1fff));
+    return value;
+}
+
+static uint64_t read_hram(Emulator* emu, uint64_t n){
+    /* The slow path: the last page is never mapped */
+    u8 value = 0;
+    for (uint64_t i = 0; i < n; i ++) value += read(emu, HIGH_RAM + ((i + value) & 0x3f));
+    return value;
+}
+
+static uint64_t read_div(Emulator* emu, uint64_t n){
+    /* An IO register derived from the cycle counter */
+    u8 value = 0;
+    for (uint64_t i = 0; i < n; i ++) {
+        emu->cycles += value & 3;
+        value += read(emu, 0xff04);
+    }
+    return value;
+}
+
+static uint64_t write_wram(Emulator* emu, uint64_t n){
+    for (uint64_t i = 0; i < n; i ++) write(emu, 0xc000 + (i & 0x1fff), i);
+    return emu->wram1[0];
+}
+
+static uint64_t write_hram(Emulator* emu, uint64_t n){
+    for (uint64_t i = 0; i < n; i ++) write(emu, HIGH_RAM + (i & 0x3f), i);
+    return emu->hram[0];
+}
+
+static uint64_t write_apu(Emulator* emu, uint64_t n){
+    /* Sound registers with audio off, which only stores them */
+    for (uint64_t i = 0; i < n; i ++) write(emu, 0xff11 + (i & 3), i);
+    return emu->IO[R_NR12];
+}
+
+static void quiet_audio(Emulator* emu, const int16_t* samples, size_t count){
+    (void)emu;
+    (void)samples;
+    sink += count;
+}
+
+static uint64_t write_vram(Emulator* emu, uint64_t n){
+    /* Tile data: the slow path, which catches the renderer up and marks the tile dirty */
+    for (uint64_t i = 0; i < n; i ++) write(emu, VRAM_8KB + (i & 0x17ff), i);
+    return emu->vram[0];
+}
+
+#define ALU_BENCH(name, call) \
+    static uint64_t name(Emulator* emu, uint64_t n){ \
+        u8 value = 0; \
+        for (uint64_t i = 0; i < n; i ++) value = call; \
+        return value; \
+    }
+
+ALU_BENCH(alu_add, add_u8_u8(emu, value, (u8)i))
+ALU_BENCH(alu_adc, adc_u8_u8(emu, value, (u8)i))
+ALU_BENCH(alu_sub, sub_u8_u8(emu, value, (u8)i))
+ALU_BENCH(alu_sbc, sbc_u8_u8(emu, value, (u8)i))
+ALU_BENCH(alu_and, and_u8_u8(emu, value | (u8)i, 0xfe))
+ALU_BENCH(alu_xor, xor_u8_u8(emu, value, (u8)i))
+ALU_BENCH(alu_or, or_u8_u8(emu, value & 0x7f, (u8)i))
+ALU_BENCH(alu_cp, (cp_u8_u8(emu, value, (u8)i), value + 1))
+ALU_BENCH(alu_inc, (inc_r8(emu, value), value + 1))
+ALU_BENCH(alu_dec, (dec_r8(emu, value), value - 1))
+ALU_BENCH(alu_rotate_left, rotate_left(emu, value ^ (u8)i, true, true))
+ALU_BENCH(alu_rotate_right, rotate_right(emu, value ^ (u8)i, true, true))
+ALU_BENCH(alu_shift_flags, shift_flags(emu, value + (u8)i, i & 1))
+ALU_BENCH(alu_daa, (A(emu) = value + (u8)i, decimal_adjust_accumulator(emu), A(emu)))
+ALU_BENCH(alu_resolve_flags, (add_u8_u8(emu, value, (u8)i), resolve_flags(emu), value + emu->AF.bytes.lower))
+
+static uint64_t alu_add_u16(Emulator* emu, uint64_t n){
+    res a, b;
+    a.entireByte = 0;
+    for (uint64_t i = 0; i < n; i ++) {
+        b.entireByte = i;
+        add_u16_RR(emu, a, b);
+        a.entireByte += emu->AF.bytes.lower;
+    }
+    return a.entireByte;
+}
+
+static uint64_t draw_lines(Emulator* emu, uint64_t n, u8 lcdc){
+    /* Background plus a window over the right half, on whatever VRAM holds */
+    emu->IO[R_LCDC] = lcdc;
+    emu->IO[R_WX] = 87;
+
+    for (uint64_t i = 0; i < n; i ++) {
+        emu->IO[R_SCX] = i;
+        ppu_draw_line(emu, i % SCREEN_HEIGHT);
+    }
+
+    emu->IO[R_LCDC] = 0x91;
+    return emu->ppu.framebuffer[0];
+}
+
+static uint64_t ppu_line(Emulator* emu, uint64_t n){
+    return draw_lines(emu, n, 0xF1);
+}
+
+static uint64_t ppu_line_sprites(Emulator* emu, uint64_t n){
+    /* The same with all 40 sprites spread over the screen, ten to a line on most lines */
+    for (int i = 0; i < SPRITE_COUNT; i ++) {
+        write(emu, OAM + i * 4, 16 + (i % 18) * 8);
+        write(emu, OAM + i * 4 + 1, 8 + i * 13 % 160);
+        write(emu, OAM + i * 4 + 2, i);
+        write(emu, OAM + i * 4 + 3, (i & 7) << 4);
+    }
+
+    uint64_t value = draw_lines(emu, n, 0xF3);
+    for (int i = 0; i < 0xA0; i ++) write(emu, OAM + i, 0);
+
+    return value;
+}
+
+typedef struct {
+    const char* name;
+    micro_body body;
+} Micro;
+
+static const Micro micros[] = {
+    { "bus.read_rom", read_rom },
+    { "bus.read_wram", read_wram },
+    { "bus.read_hram", read_hram },
+    { "bus.read_div", read_div },
+    { "bus.write_wram", write_wram },
+    { "bus.write_hram", write_hram },
+    { "bus.write_vram", write_vram },
+    { "bus.write_apu", write_apu },
+    { "alu.add_u8_u8", alu_add },
+    { "alu.adc_u8_u8", alu_adc },
+    { "alu.sub_u8_u8", alu_sub },
+    { "alu.sbc_u8_u8", alu_sbc },
+    { "alu.and_u8_u8", alu_and },
+    { "alu.xor_u8_u8", alu_xor },
+    { "alu.or_u8_u8", alu_or },
+    { "alu.cp_u8_u8", alu_cp },
+    { "alu.inc_r8", alu_inc },
+    { "alu.dec_r8", alu_dec },
+    { "alu.rotate_left", alu_rotate_left },
+    { "alu.rotate_right", alu_rotate_right },
+    { "alu.shift_flags", alu_shift_flags },
+    { "alu.decimal_adjust_accumulator", alu_daa },
+    { "alu.add_u16_RR", alu_add_u16 },
+    { "alu.resolve_flags", alu_resolve_flags },
+    { "ppu.draw_line", ppu_line },
+    { "ppu.draw_line_sprites", ppu_line_sprites },
+};
+
+/* Dispatch benchmarks: a ROM whose code is one opcode pattern repeated up to the end of the
+ * fixed bank, then a jump back. Operands that touch memory through (HL) are left out. */
+
+typedef struct {
+    const char* name;
+    u8 pattern[64];
+    size_t length;
+} Stream;
+
+static const Stream streams[] = {
+    { "dispatch.nop", { 0x00 }, 1 },
+    { "dispatch.ld_r_r", { 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4f,
+        0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5f,
+        0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7f }, 35 },
+    { "dispatch.alu_r", { 0x80, 0x81, 0x82, 0x83, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8f,
+        0x90, 0x91, 0x92, 0x93, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9f,
+        0xa0, 0xa1, 0xa2, 0xa3, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xaf,
+        0xb0, 0xb1, 0xb2, 0xb3, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbf }, 40 },
+    { "dispatch.inc_dec", { 0x04, 0x05, 0x0c, 0x0d, 0x14, 0x15, 0x1c, 0x1d, 0x3c, 0x3d, 0x03, 0x0b, 0x13, 0x1b }, 14 },
+    { "dispatch.cb", { 0xcb, 0x00, 0xcb, 0x11, 0xcb, 0x22, 0xcb, 0x33, 0xcb, 0x3f, 0xcb, 0x47, 0xcb, 0x88, 0xcb, 0xc9 }, 16 },
+};
+
+static u8* build_stream(const Stream* stream){
+    u8* rom = (u8*)calloc(0x8000, 1);
+    if (rom == NULL) return NULL;
+
+    /* PC points at the last byte fetched, so the entry NOP is at 0x100 and a jump to 0x14f
+     * resumes at 0x150 */
+    u8 entry[] = { 0x00, 0xc3, (STREAM_START - 1) & 0xff, (STREAM_START - 1) >> 8 };
+    memcpy(rom + 0x100, entry, sizeof(entry));
+
+    size_t at = STREAM_START;
+    while (at + stream->length <= STREAM_END) {
+        memcpy(rom + at, stream->pattern, stream->length);
+        at += stream->length;
+    }
+
+    memcpy(rom + at, entry + 1, 3);
+    return rom;
+}
+
+/* Timing check: a few streams run for a whole number of passes, with the T-cycles one pass
+ * has to cost. Execution starts at the entry JP, which takes 16 before the first pass. */
+
+#define TIMING_PASSES 100
+#define TIMING_ENTRY_CYCLES 16
+
+typedef struct {
+    Stream stream;
+    uint64_t instructions;      /* Per pass */
+    uint64_t cycles;
+} Timing;
+
+static const Timing timings[] = {
+    { { "nop", { 0x00 }, 1 }, 1, 4 },
+    { { "cb_r8", { 0xcb, 0x00, 0xcb, 0x11, 0xcb, 0x22, 0xcb, 0x33, 0xcb, 0x3f, 0xcb, 0x47, 0xcb, 0x88, 0xcb, 0xc9 }, 16 },
+        8, 8 * 8 },
+    { { "cb_hl", { 0x21, 0x00, 0xc0, 0xcb, 0x06, 0xcb, 0x46, 0xcb, 0x86, 0xcb, 0xc6, 0xcb, 0x3e }, 13 },
+        6, 12 + 16 + 12 + 16 + 16 + 16 },    /* LD HL,0xC000 then RLC, BIT, RES, SET, SRL (HL) */
+};
+
+static bool check_timing(void){
+    size_t count = sizeof(timings) / sizeof(timings[0]);
+    bool ok = true;
+
+    for (size_t i = 0; i < count; i ++) {
+        u8* rom = build_stream(&timings[i].stream);
+        Cartridge cart;
+        initCartridge(&cart, rom, 0x8000);
+        Emulator* emu = quiet_emulator(&cart);
+
+        Start(&cart, emu, UINT64_MAX, 1 + TIMING_PASSES * timings[i].instructions);
+        uint64_t expected = TIMING_ENTRY_CYCLES + TIMING_PASSES * timings[i].cycles;
+
+        if (emu->cycles != expected) {
+            printf("%s: %llu T-cycles, expected %llu\n", timings[i].stream.name,
+                (unsigned long long)emu->cycles, (unsigned long long)expected);
+            ok = false;
+        }
+
+        destroyEmulator(emu);
+        free(rom);
+    }
+
+    return ok;
+}
+
+static void write_micro(FILE* out, const char* name, uint64_t operations, double seconds, bool last){
+    fprintf(out, "    {\"name\": \"%s\", \"operations\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.3f}%s\n",
+        name, (unsigned long long)operations, seconds, seconds * 1e9 / operations, last ? "" : ",");
+}
+
+static void run_micros(FILE* out, uint64_t operations){
+    u8* rom = build_stream(&streams[0]);
+    Cartridge cart;
+    initCartridge(&cart, rom, 0x8000);
+    Emulator* emu = quiet_emulator(&cart);
+
+    size_t count = sizeof(micros) / sizeof(micros[0]);
+    for (size_t i = 0; i < count; i ++) {
+        double best = 0;
+
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat ++) {
+            double started = now();
+            sink += micros[i].body(emu, operations);
+            double seconds = now() - started;
+
+            if (repeat == 0 || seconds < best) best = seconds;
+        }
+
+        write_micro(out, micros[i].name, operations, best, false);
+    }
+
+    destroyEmulator(emu);
+    free(rom);
+}
+
+static void run_streams(FILE* out, uint64_t operations){
+    size_t count = sizeof(streams) / sizeof(streams[0]);
+
+    for (size_t i = 0; i < count; i ++) {
+        u8* rom = build_stream(&streams[i]);
+        Cartridge cart;
+        initCartridge(&cart, rom, 0x8000);
+
+        double best = 0;
+        uint64_t cycles = 0;
+        bool stopped = false;
+
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat ++) {
+            Emulator* emu = quiet_emulator(&cart);
+
+            double started = now();
+            Start(&cart, emu, UINT64_MAX, operations);
+            double seconds = now() - started;
+
+            if (repeat == 0 || seconds < best) best = seconds;
+            cycles = emu->cycles;
+            stopped = emu->instructions < operations;
+            destroyEmulator(emu);
+        }
+
+        fprintf(out, "    {\"name\": \"%s\", \"operations\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"mips\": %.3f, \"emulated_mhz\": %.3f, \"stopped\": %s}%s\n",
+            streams[i].name, (unsigned long long)operations, best, best * 1e9 / operations,
+            best > 0 ? operations / best / 1e6 : 0.0, best > 0 ? cycles / best / 1e6 : 0.0,
+            stopped ? "true" : "false", i + 1 < count ? "," : "");
+
+        free(rom);
+    }
+}
+
+static void run_macro(FILE* out, const char* path, uint64_t budget, bool last){
+    size_t size;
+    uint8_t* memory = mapRom(path, &size);
+
+    fprintf(out, "    {\"rom\": \"%s\"", path);
+
+    if (memory == NULL) {
+        fprintf(out, ", \"error\": \"cannot open\"}%s\n", last ? "" : ",");
+        return;
+    }
+
+    Cartridge cart;
+    initCartridge(&cart, memory, size);
+
+    double best[3] = { 0, 0, 0 };
+    uint64_t cycles = 0, instructions = 0, idle = 0;
+    bool stopped = false;
+
+    /* Rendering every frame, headless, then rendering with audio on */
+    for (int mode = 0; mode < 3; mode ++) {
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat ++) {
+            Emulator* emu = quiet_emulator(&cart);
+            emulator_set_render(emu, mode == 1 ? 0 : 1);
+            if (mode == 2) emulator_set_audio(emu, quiet_audio);
+
+            double started = now();
+            emulator_run(emu, budget);
+            double seconds = now() - started;
+
+            if (repeat == 0 || seconds < best[mode]) best[mode] = seconds;
+            cycles = emu->cycles;
+            instructions = emu->instructions;
+            idle = emu->idle.skipped_cycles;
+            stopped = emu->error != EMU_OK;
+            destroyEmulator(emu);
+        }
+    }
+
+    double frames = (double)cycles / CYCLES_PER_FRAME;
+
+    fprintf(out, ", \"budget\": %llu, \"cycles\": %llu, \"instructions\": %llu, \"idle_cycles\": %llu, \"stopped\": %s",
+        (unsigned long long)budget, (unsigned long long)cycles, (unsigned long long)instructions,
+        (unsigned long long)idle, stopped ? "true" : "false");
+
+    if (stopped) {
+        /* The time is startup and an early exit, no rate of it means anything */
+        fprintf(out, "}%s\n", last ? "" : ",");
+        unmapRom(memory, size);
+        return;
+    }
+
+    fprintf(out, ", \"seconds\": %.6f, \"emulated_mhz\": %.3f, \"mips\": %.3f, \"fps\": %.1f, \"realtime\": %.2f",
+        best[0], best[0] > 0 ? cycles / best[0] / 1e6 : 0.0, best[0] > 0 ? instructions / best[0] / 1e6 : 0.0,
+        best[0] > 0 ? frames / best[0] : 0.0, best[0] > 0 ? (double)cycles / CPU_CLOCK_HZ / best[0] : 0.0);
+    fprintf(out, ", \"seconds_headless\": %.6f, \"fps_headless\": %.1f, \"headless_speedup\": %.2f",
+        best[1], best[1] > 0 ? frames / best[1] : 0.0, best[1] > 0 ? best[0] / best[1] : 0.0);
+    fprintf(out, ", \"seconds_audio\": %.6f, \"fps_audio\": %.1f}%s\n",
+        best[2], best[2] > 0 ? frames / best[2] : 0.0, last ? "" : ",");
+
+    unmapRom(memory, size);
+}
+
+/* Render benchmark input: the video state at the end of every frame the ROM shows, recorded
+ * by running it headless. */
+
+typedef struct {
+    u8 vram[0x2000];
+    u8 oam[0xA0];
+    u8 io[R_WX - R_LCDC + 1];       /* LCDC ~ WX */
+} RenderFrame;
+
+static size_t record_frames(Cartridge* cart, RenderFrame* recorded, uint64_t frames){
+    /* Returns how many frames were recorded, fewer than asked when the ROM stops. Frames
+     * with the LCD off show nothing and are left out. */
+    Emulator* emu = quiet_emulator(cart);
+    size_t count = 0;
+
+    emulator_set_render(emu, 0);
+
+    for (uint64_t frame = 0; frame < frames * 2 && count < frames; frame ++) {
+        run_frame(emu);
+        if (emu->error != EMU_OK) break;
+        if (!(emu->IO[R_LCDC] & 0x80)) continue;                /* LCD off */
+
+        memcpy(recorded[count].vram, emu->vram, sizeof(recorded[count].vram));
+        memcpy(recorded[count].oam, emu->oam, sizeof(recorded[count].oam));
+        memcpy(recorded[count].io, emu->IO + R_LCDC, sizeof(recorded[count].io));
+        count ++;
+    }
+
+    destroyEmulator(emu);
+    return count;
+}
+
+static double draw_frames(Emulator* emu, const RenderFrame* recorded, size_t count){
+    /* Replays the recording: the bytes a frame changed go through the bus, which marks the
+     * tiles dirty as the game's own writes did, then the screen is drawn. Only drawing is
+     * timed. */
+    double seconds = 0;
+
+    for (size_t frame = 0; frame < count; frame ++) {
+        const RenderFrame* next = &recorded[frame];
+
+        for (int i = 0; i < 0x2000; i ++)
+            if (emu->vram[i] != next->vram[i]) write(emu, VRAM_8KB + i, next->vram[i]);
+        for (int i = 0; i < 0xA0; i ++)
+            if (emu->oam[i] != next->oam[i]) write(emu, OAM + i, next->oam[i]);
+        memcpy(emu->IO + R_LCDC, next->io, sizeof(next->io));
+
+        double started = now();
+        for (int line = 0; line < SCREEN_HEIGHT; line ++) ppu_draw_line(emu, line);
+        seconds += now() - started;
+    }
+
+    return seconds;
+}
+
+static void synthesise_frames(const u8* memory, size_t size, RenderFrame* frames, size_t count){
+    /* A stress pattern next to the recording: the ROM stands in for tile data (its graphics
+     * usually sit past the fixed bank), both maps go through every tile, the window covers
+     * the right half, and one tile byte changes per frame as an animated tile would. */
+    RenderFrame* first = &frames[0];
+    size_t from = size >= 0x4000 + TILE_DATA_SIZE ? 0x4000 : 0;
+
+    memset(first, 0, sizeof(RenderFrame));
+    memcpy(first->vram, memory + from, size - from < TILE_DATA_SIZE ? size - from : TILE_DATA_SIZE);
+    for (int i = 0; i < 0x800; i ++) first->vram[0x1800 + i] = i * 7;
+
+    first->io[0] = 0xE1;
+    first->io[R_SCY - R_LCDC] = 3;
+    first->io[R_SCX - R_LCDC] = 5;
+    first->io[R_BGP - R_LCDC] = 0xFC;
+    first->io[R_WX - R_LCDC] = 87;
+
+    for (size_t frame = 1; frame < count; frame ++) {
+        frames[frame] = frames[frame - 1];
+        frames[frame].vram[(frame % TILE_COUNT) * 16 + (frame & 15)] = frame;
+    }
+}
+
+static void measure_render(FILE* out, Cartridge* cart, const RenderFrame* frames, size_t count){
+    Emulator* emu = quiet_emulator(cart);
+    double best[2] = { 0, 0 };
+    uint64_t hits = 0, misses = 0;
+
+    for (int cached = 1; cached >= 0; cached --) {
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat ++) {
+            emu->ppu.tile_cache = cached;
+            emu->ppu.tile_hits = emu->ppu.tile_misses = 0;
+            ppu_invalidate_tiles(emu);
+
+            double seconds = draw_frames(emu, frames, count);
+            if (repeat == 0 || seconds < best[cached]) best[cached] = seconds;
+        }
+
+        if (cached) {
+            hits = emu->ppu.tile_hits;
+            misses = emu->ppu.tile_misses;
+        }
+    }
+
+    fprintf(out, ", \"frames\": %llu, \"frame_us\": %.3f, \"frame_us_uncached\": %.3f, \"speedup\": %.2f, \"tile_hits\": %llu, \"tile_misses\": %llu}",
+        (unsigned long long)count, best[1] * 1e6 / count, best[0] * 1e6 / count,
+        best[1] > 0 ? best[0] / best[1] : 0.0, (unsigned long long)hits, (unsigned long long)misses);
+
+    destroyEmulator(emu);
+}
+
+static void run_render(FILE* out, const char* path, uint64_t frames, bool last){
+    /* Two entries per ROM: the frames it really shows, then the synthetic pattern */
+    size_t size;
+    uint8_t* memory = mapRom(path, &size);
+    RenderFrame* recorded = (RenderFrame*)malloc(frames * sizeof(RenderFrame));
+
+    if (memory == NULL || recorded == NULL) {
+        fprintf(out, "    {\"rom\": \"%s\", \"error\": \"%s\"}%s\n", path, memory == NULL ? "cannot open" : "out of memory", last ? "" : ",");
+        if (memory != NULL) unmapRom(memory, size);
+        free(recorded);
+        return;
+    }
+
+    Cartridge cart;
+    initCartridge(&cart, memory, size);
+
+    size_t count = record_frames(&cart, recorded, frames);
+    fprintf(out, "    {\"rom\": \"%s\", \"input\": \"recorded\"", path);
+    if (count > 0) measure_render(out, &cart, recorded, count);
+    else fprintf(out, ", \"error\": \"no frame shown\"}");
+    fprintf(out, ",\n");
+
+    synthesise_frames(memory, size, recorded, frames);
+    fprintf(out, "    {\"rom\": \"%s\", \"input\": \"synthetic\"", path);
+    measure_render(out, &cart, recorded, frames);
+    fprintf(out, "%s\n", last ? "" : ",");
+
+    free(recorded);
+    unmapRom(memory, size);
+}
+
+int main(int argc, char* argv[]){
+    uint64_t operations = DEFAULT_MICRO_OPERATIONS;
+    uint64_t budget = DEFAULT_MACRO_CYCLES;
+    uint64_t frames = DEFAULT_RENDER_FRAMES;
+    const char* outPath = NULL;
+    int first = argc;
+
+    for (int i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) operations = strtoull(argv[++ i], NULL, 0);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) budget = strtoull(argv[++ i], NULL, 0);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) frames = strtoull(argv[++ i], NULL, 0);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) outPath = argv[++ i];
+        else if (strcmp(argv[i], "-t") == 0) {
+            bool ok = check_timing();
+            printf(ok ? "Instruction timings match.\n" : "Instruction timings differ.\n");
+            return ok ? 0 : 1;
+        }
+        else if (argv[i][0] == '-') {
+            printf("Usage: %s [options] [rom ...]\n", argv[0]);
+            printf("  -n <count>  operations per micro benchmark (default %d)\n", DEFAULT_MICRO_OPERATIONS);
+            printf("  -c <count>  T-cycles per ROM (default %llu, ten emulated seconds)\n", DEFAULT_MACRO_CYCLES);
+            printf("  -f <count>  frames recorded (and synthesised) per ROM for the render benchmark (default %d)\n", DEFAULT_RENDER_FRAMES);
+            printf("  -o <file>   write the JSON results to <file> instead of stdout\n");
+            printf("  -t          only check the T-cycles of fixed instruction streams\n");
+            exit(1);
+        }
+        else {
+            first = i;
+            break;
+        }
+    }
+
+    if (operations == 0) operations = 1;
+    if (frames == 0) frames = 1;
+
+    FILE* out = outPath != NULL ? fopen(outPath, "w") : stdout;
+    if (out == NULL) {
+        printf("Cannot write %s.\n", outPath);
+        exit(10);
+    }
+
+    fprintf(out, "{\n  \"format\": %d, \"repeats\": %d,\n  \"micro\": [\n", BENCH_FORMAT, BENCH_REPEATS);
+    run_micros(out, operations);
+    run_streams(out, operations);
+    fprintf(out, "  ],\n  \"macro\": [\n");
+
+    for (int i = first; i < argc; i ++) run_macro(out, argv[i], budget, i + 1 == argc);
+
+    fprintf(out, "  ],\n  \"render\": [\n");
+
+    for (int i = first; i < argc; i ++) run_render(out, argv[i], frames, i + 1 == argc);
+
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -1,9 +1,73 @@
 #include "cartridge.h"
 
-void initCartridge(Cartridge* cart, uint8_t* fileData, size_t fileSize){
-    if (fileData == NULL || fileSize < 0x4000) printf("Some issues with the file provided.\n");
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+uint8_t* mapRom(const char* path, size_t* size){
+    /* Maps the ROM file read-only. Nothing is copied: pages are loaded on first access and the
+     * page cache is shared by every process (and every instance) mapping the same file.
+     * Returns NULL when the file cannot be opened or is empty. */
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* memory = length > 0 ? (uint8_t*)malloc(length) : NULL;
+    if (memory == NULL || fread(memory, length, 1, file) != 1){
+        free(memory);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *size = length;
 
+    return memory;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0){
+        close(fd);
+        return NULL;
+    }
+
+    void* memory = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);      /* The mapping keeps the file alive */
+
+    if (memory == MAP_FAILED) return NULL;
+
+    *size = info.st_size;
+
+    return (uint8_t*)memory;
+#endif
+}
+
+void unmapRom(uint8_t* data, size_t size){
+#ifdef _WIN32
+    free(data);
+#else
+    if (data != NULL) munmap(data, size);
+#endif
+}
+
+void initCartridge(Cartridge* cart, uint8_t* fileData, size_t fileSize){
+    /* Only reads fileData (a mapping from mapRom is read-only), so one image can back any
+     * number of cartridges. */
+    memset(cart, 0, sizeof(Cartridge));
     cart->file = fileData;
+    cart->size = fileSize;
+
+    if (fileData == NULL || fileSize < 0x4000) printf("Some issues with the file provided.\n");
+    if (fileData == NULL || fileSize < 0x150) return;     /* No header to parse */
 
     memcpy(cart->logoCheckSum, &fileData[0x104], 0x30);    
     cart->licensee_code = fileData[0x145];
@@ -16,6 +80,28 @@ void initCartridge(Cartridge* cart, uint8_t* fileData, size_t fileSize){
     cart->ramsize = fileData[0x149];
 }
 
+uint64_t cartridge_hash(Cartridge* cart){
+    /* FNV-1a over 64-bit words (the tail byte by byte), computed on first use only since it
+     * reads the whole file. Identifies the ROM a save state belongs to. Not thread safe the
+     * first time it is called on a Cartridge shared between threads. */
+    if (cart->hashed) return cart->hash;
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+
+    for (; i + 8 <= cart->size; i += 8){
+        uint64_t word;
+        memcpy(&word, cart->file + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < cart->size; i ++) hash = (hash ^ cart->file[i]) * 0x100000001b3ULL;
+
+    cart->hash = hash ^ cart->size;
+    cart->hashed = true;
+
+    return cart->hash;
+}
+
 const char* stringify_new_cartridge_code(CARTRIDGE_TYPE code) {
     switch (code) {
         case CT_ROM_ONLY: return "ROM ONLY";
@@ -114,6 +114,7 @@ typedef enum {
 
 typedef struct {
     uint8_t* file;
+    size_t size;
     uint8_t* logoCheckSum[0x30];
 
     char title[11];
@@ -125,10 +126,17 @@ typedef struct {
     ROM_SIZE romSize;
     RAM_SIZE ramsize;
 
+    uint64_t hash;    /* Of the whole file, see cartridge_hash */
+    bool hashed;
+
 } Cartridge;
 
 
+uint8_t* mapRom(const char* path, size_t* size);
+void unmapRom(uint8_t* data, size_t size);
+
 void initCartridge(Cartridge* cart, uint8_t* fileData, size_t fileSize);
 void print_cartridge(Cartridge* cart);
+uint64_t cartridge_hash(Cartridge* cart);
 
 #endif
@@ -1,4 +1,15 @@
 #include "cpu.h"
+#include "trace.h"
+#include "profile.h"
+#include "idle.h"
+#include "io.h"
+#include "mbc.h"
+
+/* Interpreter core: computed goto (labels as values) where the compiler supports it, a plain
+ * switch otherwise. Build with -DSWITCH_DISPATCH to force the switch. */
+#if defined(__GNUC__) && !defined(SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
 
 /* Flags */
 
@@ -41,21 +52,100 @@
 #define ROTATE_LEFT(emu, reg, zflag, cflag) reg = rotate_left(emu, reg, zflag, cflag);
 #define ROTATE_RIGHT(emu, reg, zflag, cflag) reg = rotate_right(emu, reg, zflag, cflag);
 
+/* Instruction timings in T-cycles (4.194304 MHz clock), charged when the opcode is fetched.
+ * Conditional JR/JP/CALL/RET are listed with the branch not taken, branch_taken_cycles holds
+ * what a taken branch costs on top. Opcodes that do not exist on the Game Boy are 0. */
+static const u8 instruction_cycles[0x100] = {
+    /*       x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF */
+    /* 0x */  4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4,
+    /* 1x */  4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4,
+    /* 2x */  8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4,
+    /* 3x */  8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4,
+    /* 4x */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* 5x */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* 6x */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* 7x */  8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* 8x */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* 9x */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* Ax */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* Bx */  4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+    /* Cx */  8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  4, 12, 24,  8, 16,
+    /* Dx */  8, 12, 12,  0, 12, 16,  8, 16,  8, 16, 12,  0, 12,  0,  8, 16,
+    /* Ex */ 12, 12,  8,  0,  0, 16,  8, 16, 16,  4, 16,  0,  0,  0,  8, 16,
+    /* Fx */ 12, 12,  8,  4,  0, 16,  8, 16, 12,  8, 16,  4,  0,  0,  8, 16
+};
+
+static const u8 branch_taken_cycles[0x100] = {
+    [0x20] = 4, [0x28] = 4, [0x30] = 4, [0x38] = 4,       /* JR cc */
+    [0xC2] = 4, [0xCA] = 4, [0xD2] = 4, [0xDA] = 4,       /* JP cc */
+    [0xC4] = 12, [0xCC] = 12, [0xD4] = 12, [0xDC] = 12,   /* CALL cc */
+    [0xC0] = 12, [0xC8] = 12, [0xD0] = 12, [0xD8] = 12    /* RET cc */
+};
+
+/* CB-prefixed timings, on top of the 4 cycles of the 0xCB prefix itself. Every row of eight is
+ * B, C, D, E, H, L, (HL), A: registers take 8 in all, (HL) 16 (12 for BIT, which only reads). */
+#define CB_ROW(hl) 4, 4, 4, 4, 4, 4, hl, 4
+#define CB_ROWS_8(hl) CB_ROW(hl), CB_ROW(hl), CB_ROW(hl), CB_ROW(hl), CB_ROW(hl), CB_ROW(hl), CB_ROW(hl), CB_ROW(hl)
+
+static const u8 cb_instruction_cycles[0x100] = {
+    CB_ROWS_8(12),                    /* 0x00 ~ 0x3F: rotates, shifts and SWAP */
+    CB_ROWS_8(8),                     /* 0x40 ~ 0x7F: BIT */
+    CB_ROWS_8(12),                    /* 0x80 ~ 0xBF: RES */
+    CB_ROWS_8(12)                     /* 0xC0 ~ 0xFF: SET */
+};
+
 /* Some very imp functions */
 
-u8 read(Emulator* emu, u16 addr){
-    if (addr >= 0x0 && addr <= 0x7fff) return emu->cart->file[addr];
-    if (addr >= VRAM_8KB && addr <= VRAM_8KB_END) return emu->vram[addr - VRAM_8KB];
-    if (addr >= WRAM_4KB && addr <= WRAM_4KB_END) return emu->wram1[addr - WRAM_4KB];
-    if (addr >= WRAM_SWITCHABLE_4KB && addr <= WRAM_SWITCHABLE_4KB_END) return emu->wram2[addr - WRAM_SWITCHABLE_4KB];
-    if (addr >= HIGH_RAM && addr >= HIGH_RAM_END) return emu->hram[addr - HIGH_RAM];
-    if (addr >= IO_REGISTERS && addr <= IO_REGISTERS_END) return emu->IO[addr - IO_REGISTERS];
-    
+void map_pages(u8** map, u16 start, u16 end, u8* base){
+    /* Points every page of [start, end] at the matching offset of base (NULL unmaps them). */
+    for (int page = start >> 8; page <= end >> 8; page ++){
+        map[page] = base == NULL ? NULL : base + ((page << 8) - start);
+    }
+}
+
+void map_memory(Emulator* emu){
+    /* Builds the page tables from scratch. Bank switching only has to patch the pages it
+     * swaps, but this is the place that knows the whole layout. */
+    memset(emu->read_map, 0, sizeof(emu->read_map));
+    memset(emu->write_map, 0, sizeof(emu->write_map));
+
+    /* ROM and external RAM follow the mapper. ROM is read-only, writes to it (bank
+     * registers) go through the slow path. */
+    if (emu->cart != NULL) map_mbc(emu);
+
+    /* VRAM is read directly, writes go through the slow path so the renderer can draw the
+     * lines before them first */
+    map_pages(emu->read_map, VRAM_8KB, VRAM_8KB_END, emu->vram);
+
+    map_pages(emu->read_map, WRAM_4KB, WRAM_4KB_END, emu->wram1);
+    map_pages(emu->write_map, WRAM_4KB, WRAM_4KB_END, emu->wram1);
+
+    map_pages(emu->read_map, WRAM_SWITCHABLE_4KB, WRAM_SWITCHABLE_4KB_END, emu->wram2);
+    map_pages(emu->write_map, WRAM_SWITCHABLE_4KB, WRAM_SWITCHABLE_4KB_END, emu->wram2);
+
+    /* The last page (IO, HRAM and IE) always takes the slow path: several IO registers are
+     * derived from the cycle counter when read, and writes to them have side effects. */
+}
+
+static u8 read_slow(Emulator* emu, u16 addr){
+    if (addr >= EXTERNAL_RAM_8KB && addr <= EXTERNAL_RAM_8KB_END) return mbc_read(emu);
+    if (addr >= HIGH_RAM && addr <= HIGH_RAM_END) return emu->hram[addr - HIGH_RAM];
+    if (addr >= IO_REGISTERS && addr <= IO_REGISTERS_END) return read_io(emu, addr - IO_REGISTERS);
+    if (addr == INTERRUPT_ENABLE) return emu->IE;
+    if (addr >= OAM && addr <= OAM_END) return emu->oam[addr - OAM];
+
     //printf("Found some address, 0x%04x, which cannot be actually accessed.", addr);
 
     return 0xff;
 }
 
+u8 read(Emulator* emu, u16 addr){
+    u8* page = emu->read_map[addr >> 8];
+    if (page != NULL) return page[addr & 0xff];
+
+    return read_slow(emu, addr);
+}
+
 u16 read_u16(Emulator* emu){
     u8 lower = read(emu, ++ emu->PC.entireByte);
     u8 higher = read(emu, ++ emu->PC.entireByte);
@@ -69,57 +159,122 @@ u8 read_u8(Emulator* emu){
     return (u8)(read(emu, ++ emu->PC.entireByte));
 }
 
-static bool perform_IO_actions(Emulator* emu, u16 diff, u8 byte){
-    /* Returns whether we have to continue writing to IO after this execution. */
-    switch (diff){
-        case R_SC: {
-            if (byte == 0x81){
-                printf("%c", emu->IO[R_SB]);
-                emu->IO[R_SC] = 0x00;
-            }
-        }
+static void write_slow(Emulator* emu, u16 addr, u8 byte){
+    /* Echo RAM and the unusable range are dropped for now. */
+    if (addr <= ROM_N1_NN_16KB_END || (addr >= EXTERNAL_RAM_8KB && addr <= EXTERNAL_RAM_8KB_END)) mbc_write(emu, addr, byte);
+    else if (addr >= VRAM_8KB && addr <= VRAM_8KB_END){
+        u16 offset = addr - VRAM_8KB;
+
+        ppu_catch_up(emu);
+        emu->vram[offset] = byte;
+        if (offset < TILE_DATA_SIZE) emu->ppu.tile_dirty[offset >> 4] = 1;
+        MARK_DIRTY(emu, &emu->vram[offset]);
+    }
+    else if (addr >= OAM && addr <= OAM_END){
+        ppu_catch_up(emu);
+        ppu_write_oam(emu, addr - OAM, byte);
+    }
+    else if (addr >= HIGH_RAM && addr <= HIGH_RAM_END) emu->hram[addr - HIGH_RAM] = byte;
+    else if (addr >= IO_REGISTERS && addr <= IO_REGISTERS_END) write_io(emu, addr - IO_REGISTERS, byte);
+    else if (addr == INTERRUPT_ENABLE){
+        emu->IE = byte;
+        schedule(emu, EVENT_INTERRUPT, emu->cycles);
     }
 }
 
 static void write(Emulator* emu, u16 addr, u8 byte){
-    if ((addr >= ECHO_RAM && addr <= ECHO_RAM_END) || (addr >= NOT_USABLE && addr <= NOT_USABLE_END)) return;
-    
-    if (addr >= VRAM_8KB && addr <= VRAM_8KB_END) emu->vram[addr - VRAM_8KB] = byte;
-    else if (addr >= WRAM_4KB && addr <= WRAM_4KB_END) emu->wram1[addr - WRAM_4KB] = byte;
-    else if (addr >= WRAM_SWITCHABLE_4KB && addr <= WRAM_SWITCHABLE_4KB_END) emu->wram2[addr - WRAM_SWITCHABLE_4KB] = byte;
-    else if (addr >= HIGH_RAM && addr <= HIGH_RAM_END) emu->hram[addr - HIGH_RAM] = byte;
-    else if (addr >= IO_REGISTERS && addr <= IO_REGISTERS_END){
-        if (perform_IO_actions(emu, addr - IO_REGISTERS, byte)) return;
-        emu->IO[addr - IO_REGISTERS] = byte;
+    /* Every page mapped for writing is a page of bulk memory, so marking it dirty is one
+     * subtraction away. */
+    u8* page = emu->write_map[addr >> 8];
+    if (page != NULL){
+        page[addr & 0xff] = byte;
+        MARK_DIRTY(emu, page);
     }
+    else write_slow(emu, addr, byte);
+}
+
+static void push_u16(Emulator* emu, u16 value){
+    emu->SP.entireByte -= 2;
+    write(emu, emu->SP.entireByte, value & 0xff);
+    write(emu, emu->SP.entireByte + 1, value >> 8);
+}
+
+static u16 pop_u16(Emulator* emu){
+    u16 value = read(emu, emu->SP.entireByte) | (read(emu, emu->SP.entireByte + 1) << 8);
+    emu->SP.entireByte += 2;
+
+    return value;
 }
 
-void Start(Cartridge* cart, Emulator* emu){
-    emu->cart = cart;
+static void service_interrupts(Emulator* emu){
+    /* Delivers the highest priority (lowest bit) interrupt that is both requested and enabled.
+     * PC always points at the last byte fetched, so the return address is PC + 1 and the
+     * vector is entered one byte early. */
+    u8 pending = emu->IO[R_IF] & emu->IE & 0x1F;
+    if (pending) emu->halted = false;   /* Any requested interrupt wakes HALT, even with IME off */
+    if (!emu->ime || pending == 0) return;
 
-    int dispatch_count = 0;
+    u8 bit = 0;
+    while (!(pending & (1 << bit))) bit ++;
 
-    emu->run = true;
+    emu->IO[R_IF] &= ~(1 << bit);
+    emu->ime = false;
 
-    while (dispatch_count < 2074879 && emu->run) {
-        dispatch_count += 1;
-        //printf("\n-- DISPATCH %d --\n", dispatch_count);
-        dispatch(emu);
+    push_u16(emu, emu->PC.entireByte + 1);
+    emu->PC.entireByte = 0x40 + bit * 8 - 1;
+
+    PROFILE_INTERRUPT(emu, 0x40 + bit * 8);     /* Before the dispatch cycles, see profile.h */
+    emu->cycles += 20;
+}
+
+static void run_events(Emulator* emu){
+    /* Fires everything that is due, then delivers whatever interrupt that caused. */
+    u8 type;
+
+    while ((type = pop_due_event(&emu->scheduler, emu->cycles)) != EVENT_NONE) handle_event(emu, type);
+    service_interrupts(emu);
+}
+
+static void execute(Emulator* emu, uint64_t until_cycle, uint64_t max_instructions);
+static void execute_block(Emulator* emu, uint64_t max_instructions);
+
+void Start(Cartridge* cart, Emulator* emu, uint64_t max_cycles, uint64_t max_instructions){
+    /* Runs until either budget is spent (counted from power on), or execution stops. */
+    if (emu->cart != cart){
+        /* A restored state already has its mapper set up */
+        emu->cart = cart;
+        init_mbc(emu);
     }
+
+    emu->run = emu->error == EMU_OK;
+    map_memory(emu);
+
+    execute(emu, max_cycles, max_instructions);
+}
+
+uint64_t run_cycles(Emulator* emu, uint64_t cycles){
+    /* Instructions are atomic, so this can overshoot by the tail of the last one. The counter
+     * is absolute, so the next call starts from wherever this one really ended. */
+    uint64_t start = emu->cycles;
+    execute(emu, emu->cycles + cycles, UINT64_MAX);
+
+    return emu->cycles - start;
+}
+
+void run_frame(Emulator* emu){
+    execute(emu, (emu->cycles / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME, UINT64_MAX);
 }
 
+static void defer_flags(Emulator* emu, flag_op op, u8 val1, u8 val2, u8 result, u8 carry);
+
 static void inc_r8(Emulator* emu, u8 oldval){
     /* Old val is reg's value before incrementing. The actual incrementing is done after this function.*/
     
-    set_flagz(emu, oldval + 1);
-    set_flagh_add(emu, oldval, 1);
-    modify_flag(emu, flag_n, 0);
+    defer_flags(emu, FLAGS_INC, oldval, 1, 0, 0);
 }
 
 static void dec_r8(Emulator* emu, u8 oldval){
-    set_flagz(emu, oldval + 1);
-    set_flagh_sub(emu, oldval, 1);
-    modify_flag(emu, flag_n, 1);
+    defer_flags(emu, FLAGS_DEC, oldval, 1, 0, 0);
 }
 
 static u8 rotate_left(Emulator* emu, u8 reg_value, bool zflag, bool carry_flag){
@@ -138,10 +293,7 @@ static u8 rotate_left(Emulator* emu, u8 reg_value, bool zflag, bool carry_flag){
     reg_value <<= 1;
     reg_value |= carry_flag ? getflag(emu, flag_c) : lastbit;
 
-    modify_flag(emu, flag_z, zflag ? !reg_value : 0);
-    modify_flag(emu, flag_h, 0);
-    modify_flag(emu, flag_n, 0);
-    modify_flag(emu, flag_c, lastbit);
+    defer_flags(emu, FLAGS_ROTATE, zflag, 0, reg_value, lastbit);
 
     return reg_value;
 }
@@ -163,10 +315,7 @@ static u8 rotate_right(Emulator* emu, u8 reg_value, bool zflag, bool carry_flag)
     reg_value >>= 1;
     reg_value |= (carry_flag ? getflag(emu, flag_c) : firstbit) << 7;
 
-    modify_flag(emu, flag_z, zflag ? !reg_value : 0);
-    modify_flag(emu, flag_h, 0);
-    modify_flag(emu, flag_n, 0);
-    modify_flag(emu, flag_c, firstbit);
+    defer_flags(emu, FLAGS_ROTATE, zflag, 0, reg_value, firstbit);
 
     return reg_value;
 }
@@ -247,10 +396,16 @@ static void halt_emulator(Emulator* emu){
      * This is used to temporarily halt the execution of the CPU until an interrupt occurs.
      * When the HALT instruction is executed, the CPU enters a low-power state :
      * Minimal power is consumed until an interrupt signal is passed, to resume normal operation.
+     *
+     * Nothing but the peripherals can change state while halted, so execute() skips the
+     * cycle counter straight to the next event instead of stepping. If an interrupt is
+     * already pending the CPU does not halt at all.
     */
 
-   emu->run = false;
-   printf("Came across the HALT instruction : : Stopping all execution.\n");
+    if (emu->IO[R_IF] & emu->IE & 0x1F) return;
+
+    emu->halted = true;
+    emu->block_end = emu->cycles;
 }
 
 static void add_u16_RR(Emulator* emu, res res1, res res2){
@@ -312,6 +467,96 @@ static void test_sbc_hc_flags(Emulator* emu, u8 old, u8 toSub, u8 result, u8 car
     modify_flag(emu, flag_c, carryOccured);
 }
 
+static void apply_flags(Emulator* emu, flag_op op, u8 val1, u8 val2, u8 result, u8 carry){
+    /* The one place that knows how each ALU op sets Z/N/H/C. Eager builds call it straight
+     * from the helpers, lazy builds only once F is actually needed. */
+    switch (op){
+        case FLAGS_ADD:
+            set_flagz(emu, result);
+            modify_flag(emu, flag_n, 0);
+            set_flagh_add(emu, val1, val2);
+            set_flagc_add(emu, val1, val2);
+            break;
+        case FLAGS_ADC:
+            set_flagz(emu, result);
+            modify_flag(emu, flag_n, 0);
+            test_adc_hc_flags(emu, val1, val2, result - carry, carry);
+            break;
+        case FLAGS_SUB:
+            set_flagz(emu, result);
+            modify_flag(emu, flag_n, 1);
+            set_flagh_sub(emu, val1, val2);
+            set_flagc_sub(emu, val1, val2);
+            break;
+        case FLAGS_SBC:
+            set_flagz(emu, result);
+            modify_flag(emu, flag_n, 1);
+            test_sbc_hc_flags(emu, val1, val2, result + carry, carry);
+            break;
+        case FLAGS_AND:
+            set_flagz(emu, result);
+            modify_flag(emu, flag_n, 0);
+            modify_flag(emu, flag_h, 1);
+            modify_flag(emu, flag_c, 0);
+            break;
+        case FLAGS_XOR:
+        case FLAGS_OR:
+            set_flagz(emu, result);
+            modify_flag(emu, flag_n, 0);
+            modify_flag(emu, flag_h, 0);
+            modify_flag(emu, flag_c, 0);
+            break;
+        case FLAGS_ROTATE:
+            /* val1 is whether Z is computed at all, carry the bit that was shifted out */
+            modify_flag(emu, flag_z, val1 ? !result : 0);
+            modify_flag(emu, flag_h, 0);
+            modify_flag(emu, flag_n, 0);
+            modify_flag(emu, flag_c, carry);
+            break;
+        case FLAGS_CP:
+            modify_flag(emu, flag_n, 1);
+            set_flagh_sub(emu, val1, val2);
+            set_flagc_sub(emu, val1, val2);
+            break;
+        case FLAGS_INC:
+            set_flagz(emu, val1 + 1);
+            set_flagh_add(emu, val1, 1);
+            modify_flag(emu, flag_n, 0);
+            break;
+        case FLAGS_DEC:
+            set_flagz(emu, val1 + 1);
+            set_flagh_sub(emu, val1, 1);
+            modify_flag(emu, flag_n, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+void resolve_flags(Emulator* emu){
+    LazyFlags lazy = emu->lazy;
+    if (lazy.op == FLAGS_RESOLVED) return;
+
+    emu->lazy.op = FLAGS_RESOLVED;
+    apply_flags(emu, lazy.op, lazy.val1, lazy.val2, lazy.result, lazy.carry);
+}
+
+static void defer_flags(Emulator* emu, flag_op op, u8 val1, u8 val2, u8 result, u8 carry){
+#ifdef EAGER_FLAGS
+    apply_flags(emu, op, val1, val2, result, carry);
+#else
+    /* A full op makes whatever is pending irrelevant (they only ever touch bits 4-7 of F), a
+     * partial one keeps some of the old flags, so those have to be in F before recording. */
+    if (op >= FLAGS_PARTIAL && emu->lazy.op != FLAGS_RESOLVED) resolve_flags(emu);
+
+    emu->lazy.op = op;
+    emu->lazy.val1 = val1;
+    emu->lazy.val2 = val2;
+    emu->lazy.result = result;
+    emu->lazy.carry = carry;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 static u8 add_u8_u8(Emulator* emu, u8 val1, u8 val2){
@@ -321,10 +566,7 @@ static u8 add_u8_u8(Emulator* emu, u8 val1, u8 val2){
 
     u8 result = val1 + val2;
 
-    set_flagz(emu, result);
-    modify_flag(emu, flag_n, 0);
-    set_flagh_add(emu, val1, val2);
-    set_flagc_add(emu, val1, val2);
+    defer_flags(emu, FLAGS_ADD, val1, val2, result, 0);
 
     return result;
 }
@@ -337,10 +579,7 @@ static u8 adc_u8_u8(Emulator* emu, u8 val1, u8 val2) {
     u8 carry = getflag(emu, flag_c);
     u8 result = val1 + val2 + carry;
 
-    set_flagz(emu, result);
-    modify_flag(emu, flag_n, 0);
-
-    test_adc_hc_flags(emu, val1, val2, result - carry, carry);
+    defer_flags(emu, FLAGS_ADC, val1, val2, result, carry);
 
     return result;
 }
@@ -352,10 +591,7 @@ static u8 sub_u8_u8(Emulator* emu, u8 val1, u8 val2){
 
     u8 result = val1 - val2;
 
-    set_flagz(emu, result);
-    modify_flag(emu, flag_n, 1);
-    set_flagh_sub(emu, val1, val2);
-    set_flagc_sub(emu, val1, val2);
+    defer_flags(emu, FLAGS_SUB, val1, val2, result, 0);
 
     return result;
 }
@@ -368,9 +604,7 @@ static u8 sbc_u8_u8(Emulator* emu, u8 val1, u8 val2){
     u8 carry = getflag(emu, flag_c);
     u8 result = val1 - val2 - carry;
 
-    set_flagz(emu, result);
-    modify_flag(emu, flag_n, 1);
-    test_sbc_hc_flags(emu, val1, val2, result + carry, carry);
+    defer_flags(emu, FLAGS_SBC, val1, val2, result, carry);
 
     return result;
 }
@@ -378,11 +612,7 @@ static u8 sbc_u8_u8(Emulator* emu, u8 val1, u8 val2){
 static u8 and_u8_u8(Emulator* emu, u8 val1, u8 val2){
     u8 result = val1 & val2;
 
-    set_flagz(emu, result);
-    
-    modify_flag(emu, flag_n, 0);
-    modify_flag(emu, flag_h, 1);
-    modify_flag(emu, flag_c, 0);
+    defer_flags(emu, FLAGS_AND, val1, val2, result, 0);
 
     return result;
 }
@@ -390,11 +620,7 @@ static u8 and_u8_u8(Emulator* emu, u8 val1, u8 val2){
 static u8 xor_u8_u8(Emulator* emu, u8 val1, u8 val2){
     u8 result = val1 ^ val2;
 
-    set_flagz(emu, result);
-    
-    modify_flag(emu, flag_n, 0);
-    modify_flag(emu, flag_h, 0);
-    modify_flag(emu, flag_c, 0);
+    defer_flags(emu, FLAGS_XOR, val1, val2, result, 0);
 
     return result;
 }
@@ -402,11 +628,7 @@ static u8 xor_u8_u8(Emulator* emu, u8 val1, u8 val2){
 static u8 or_u8_u8(Emulator* emu, u8 val1, u8 val2){
     u8 result = val1 | val2;
 
-    set_flagz(emu, result);
-    
-    modify_flag(emu, flag_n, 0);
-    modify_flag(emu, flag_h, 0);
-    modify_flag(emu, flag_c, 0);
+    defer_flags(emu, FLAGS_OR, val1, val2, result, 0);
 
     return result;
 }
@@ -414,91 +636,256 @@ static u8 or_u8_u8(Emulator* emu, u8 val1, u8 val2){
 static void cp_u8_u8(Emulator* emu, u8 val1, u8 val2){
     u8 result = val1 - val2;
     
-    modify_flag(emu, flag_n, 1);
-
-    set_flagh_sub(emu, val1, val2);
-    set_flagc_sub(emu, val1, val2);
+    defer_flags(emu, FLAGS_CP, val1, val2, result, 0);
 }
 
-static void jump_relative_condition(Emulator* emu, bool condition_status){
-    int8_t jp_count = (int8_t) read_u8(emu); /* 4 cycles */
+static bool jump_relative_condition(Emulator* emu, bool condition_status){
+    /* Returns whether the jump was taken, the caller charges the extra cycles. */
+    int8_t jp_count = (int8_t) read_u8(emu);
     if (condition_status){
         emu->PC.entireByte += jp_count;
-        /* 4 Cycles */
     }
+
+    return condition_status;
 }
 
-void dispatch(Emulator* emu){
-    
-    printRegisters(emu);
-    printInstruction(emu);
-    
+static u8 get_r8(Emulator* emu, u8 index){
+    /* Register operand encoding shared by the CB opcodes: B, C, D, E, H, L, (HL), A */
+    switch (index){
+        case 0: return B(emu);
+        case 1: return C(emu);
+        case 2: return D(emu);
+        case 3: return E(emu);
+        case 4: return H(emu);
+        case 5: return L(emu);
+        case 6: return read(emu, HL(emu));
+        default: return A(emu);
+    }
+}
+
+static void set_r8(Emulator* emu, u8 index, u8 value){
+    switch (index){
+        case 0: B(emu) = value; break;
+        case 1: C(emu) = value; break;
+        case 2: D(emu) = value; break;
+        case 3: E(emu) = value; break;
+        case 4: H(emu) = value; break;
+        case 5: L(emu) = value; break;
+        case 6: write(emu, HL(emu), value); break;
+        default: A(emu) = value; break;
+    }
+}
+
+static u8 shift_flags(Emulator* emu, u8 result, u8 carry){
+    set_flagz(emu, result);
+    modify_flag(emu, flag_n, 0);
+    modify_flag(emu, flag_h, 0);
+    modify_flag(emu, flag_c, carry);
+
+    return result;
+}
+
+static void execute_cb(Emulator* emu){
+    /* The CB opcodes are regular enough to decode instead of listing all 256:
+     * bits 0-2 pick the operand, bits 3-5 the bit number (or the shift kind), bits 6-7 the group. */
     u8 opcode = read_u8(emu);
+    u8 index = opcode & 7;
+    u8 bit = (opcode >> 3) & 7;
+    u8 value = get_r8(emu, index);
+
+    emu->cycles += cb_instruction_cycles[opcode];
+
+    switch (opcode >> 6){
+        case 0: {
+            switch (bit){
+                case 0: value = rotate_left(emu, value, true, false); break;    /* RLC */
+                case 1: value = rotate_right(emu, value, true, false); break;   /* RRC */
+                case 2: value = rotate_left(emu, value, true, true); break;     /* RL */
+                case 3: value = rotate_right(emu, value, true, true); break;    /* RR */
+                case 4: value = shift_flags(emu, value << 1, value >> 7); break;                  /* SLA */
+                case 5: value = shift_flags(emu, (value >> 1) | (value & 0x80), value & 1); break; /* SRA */
+                case 6: value = shift_flags(emu, (value << 4) | (value >> 4), 0); break;          /* SWAP */
+                case 7: value = shift_flags(emu, value >> 1, value & 1); break;                   /* SRL */
+            }
+            break;
+        }
+        case 1: {
+            /* BIT only tests, nothing is written back */
+            modify_flag(emu, flag_z, !((value >> bit) & 1));
+            modify_flag(emu, flag_n, 0);
+            modify_flag(emu, flag_h, 1);
+            return;
+        }
+        case 2: value &= ~(1 << bit); break;    /* RES */
+        case 3: value |= 1 << bit; break;       /* SET */
+    }
+
+    set_r8(emu, index, value);
+}
+
+#ifdef THREADED_DISPATCH
+
+/* Direct-threaded core: every handler ends by fetching the next opcode and jumping through
+ * the table itself, so each handler gets its own indirect branch (and its own prediction). */
+#define OPCODE(op) op_##op:
+#define UNIMPLEMENTED op_default:
+#define NEXT \
+    if (emu->cycles >= emu->block_end || emu->instructions >= max_instructions || !emu->run) return; \
+    emu->instructions ++; \
+    TRACE_INSTRUCTION(emu); \
+    PROFILE_INSTRUCTION(emu); \
+    opcode = read_u8(emu); \
+    emu->cycles += instruction_cycles[opcode]; \
+    goto *opcodes[opcode]
+
+#else
+
+#define OPCODE(op) case op:
+#define UNIMPLEMENTED default:
+#define NEXT break
+
+#endif
+
+#define BRANCH_TAKEN(emu) emu->cycles += branch_taken_cycles[opcode];
+
+#define JUMP_RELATIVE_IF(emu, condition) { \
+    u16 from = emu->PC.entireByte; \
+    if (jump_relative_condition(emu, condition)){ BRANCH_TAKEN(emu); IDLE_BRANCH(emu, from, max_instructions); } \
+}
+
+static void execute(Emulator* emu, uint64_t until_cycle, uint64_t max_instructions){
+    /* Runs until emu->cycles reaches until_cycle, emu->instructions reaches max_instructions or
+     * emu->run is cleared. The CPU runs straight-line blocks up to the next scheduled event;
+     * peripherals only get control between blocks. */
+    while (emu->run && emu->cycles < until_cycle && emu->instructions < max_instructions){
+        run_events(emu);
+
+        uint64_t stop = next_event(&emu->scheduler);
+        emu->block_end = stop < until_cycle ? stop : until_cycle;
+
+        if (emu->halted){
+            /* Idle: jump to the next event (or the budget) without dispatching anything. */
+            if (emu->block_end > emu->cycles){
+                emu->halted_cycles += emu->block_end - emu->cycles;
+                emu->cycles = emu->block_end;
+            }
+            continue;
+        }
 
-    switch (opcode){
-        case 0x00: break;
-        case 0x01: LD_u16(emu, BC(emu)); break;
-        case 0x02: LD_addr_reg(emu, read(emu, BC(emu)), A(emu)); break;
-        case 0x03: INC_RR(emu, BC(emu)); break;
-        case 0x04: INC(emu, B(emu)); break;
-        case 0x05: DEC(emu, B(emu)); break;
-        case 0x06: LD_u8(emu, B(emu)); break;
-        case 0x07: ROTATE_LEFT(emu, A(emu), false, false); break;
-        case 0x08: {
+        execute_block(emu, max_instructions);
+    }
+}
+
+static void execute_block(Emulator* emu, uint64_t max_instructions){
+    /* Runs instructions until emu->cycles reaches emu->block_end, emu->instructions reaches
+     * max_instructions or emu->run is cleared. Anything scheduled mid-block through schedule()
+     * pulls block_end in, so events never run late. The handlers are shared by both cores,
+     * only OPCODE / NEXT change meaning. */
+    u8 opcode;
+
+    /* Events may have changed anything an idle loop reads */
+    emu->idle.watching = false;
+
+#ifdef THREADED_DISPATCH
+    static const void* const opcodes[0x100] = {
+        &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07, &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+        &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17, &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+        &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27, &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+        &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37, &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+        &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47, &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+        &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57, &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+        &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67, &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+        &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77, &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+        &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87, &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+        &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97, &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7, &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+        &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7, &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+        &&op_default, &&op_default, &&op_default, &&op_0xC3, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_0xCB, &&op_default, &&op_default, &&op_0xCE, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_0xD9, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default,
+        &&op_default, &&op_default, &&op_default, &&op_0xF3, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_default, &&op_0xFB, &&op_default, &&op_default, &&op_default, &&op_default,
+    };
+
+    NEXT;
+#else
+    while (emu->cycles < emu->block_end && emu->instructions < max_instructions && emu->run) {
+        emu->instructions ++;
+        TRACE_INSTRUCTION(emu);
+        PROFILE_INSTRUCTION(emu);
+
+        opcode = read_u8(emu);
+        emu->cycles += instruction_cycles[opcode];
+
+        switch (opcode){
+#endif
+        OPCODE(0x00) NEXT;
+        OPCODE(0x01) LD_u16(emu, BC(emu)); NEXT;
+        OPCODE(0x02) LD_addr_reg(emu, read(emu, BC(emu)), A(emu)); NEXT;
+        OPCODE(0x03) INC_RR(emu, BC(emu)); NEXT;
+        OPCODE(0x04) INC(emu, B(emu)); NEXT;
+        OPCODE(0x05) DEC(emu, B(emu)); NEXT;
+        OPCODE(0x06) LD_u8(emu, B(emu)); NEXT;
+        OPCODE(0x07) ROTATE_LEFT(emu, A(emu), false, false); NEXT;
+        OPCODE(0x08) {
             u16 twobytes = read_u16(emu);
             u16 sp = emu->SP.entireByte;
 
             write(emu, twobytes + 1, sp >> 8);
             write(emu, twobytes, sp & 0xff);
-            break;
+            NEXT;
+        }
+        OPCODE(0x09) add_u16_RR(emu, emu->HL, emu->BC); NEXT;
+        OPCODE(0x0A) LD_R_u8(emu, A(emu), read(emu, BC(emu))); NEXT;  // LD A, (BC)
+        OPCODE(0x0B) DEC_RR(emu, BC(emu)); NEXT;
+        OPCODE(0x0C) INC(emu, C(emu)); NEXT;
+        OPCODE(0x0D) DEC(emu, C(emu)); NEXT;
+        OPCODE(0x0E) LD_u8(emu, C(emu)); NEXT;
+        OPCODE(0x0F) ROTATE_RIGHT(emu, A(emu), false, false); NEXT;
+
+        OPCODE(0x10) {
+            /* STOP: there is no joypad yet, so it idles like HALT until any interrupt. */
+            read_u8(emu);
+            halt_emulator(emu);
+            NEXT;
         }
-        case 0x09: add_u16_RR(emu, emu->HL, emu->BC); break;
-        case 0x0A: LD_R_u8(emu, A(emu), read(emu, BC(emu))); break;  // LD A, (BC)
-        case 0x0B: DEC_RR(emu, BC(emu)); break;
-        case 0x0C: INC(emu, C(emu)); break;
-        case 0x0D: DEC(emu, C(emu)); break;
-        case 0x0E: LD_u8(emu, C(emu)); break;
-        case 0x0F: ROTATE_RIGHT(emu, A(emu), false, false); break;
-
-        case 0x10: break;
-        case 0x11: LD_u16(emu, DE(emu)); break;
-        case 0x12: LD_addr_reg(emu, read(emu, DE(emu)), A(emu)); break;
-        case 0x13: INC_RR(emu, DE(emu)); break;
-        case 0x14: INC(emu, D(emu)); break;
-        case 0x15: DEC(emu, D(emu)); break;
-        case 0x16: LD_u8(emu, D(emu)); break;
-        case 0x17: ROTATE_LEFT(emu, A(emu), false, true); break;
-        case 0x18: JUMP_RELATIVE(emu, read_u8(emu)); break;
-        case 0x19: add_u16_RR(emu, emu->HL, emu->DE); break;
-        case 0x1A: LD_R_u8(emu, A(emu), read(emu, DE(emu))); break;  // LD A, (DE)
-        case 0x1B: DEC_RR(emu, DE(emu)); break;
-        case 0x1C: INC(emu, E(emu)); break;
-        case 0x1D: DEC(emu, E(emu)); break;
-        case 0x1E: LD_u8(emu, E(emu)); break;
-        case 0x1F: ROTATE_RIGHT(emu, A(emu), false, true); break;
-
-        case 0x20: jump_relative_condition(emu, CONDITION_NZ(emu)); break;
-        case 0x21: LD_u16(emu, HL(emu)); break;
-        case 0x22: LD_addr_reg(emu, read(emu, HL(emu)), A(emu)); INC_RR(emu, HL(emu)); break;
-        case 0x23: INC_RR(emu, HL(emu)); break;
-        case 0x24: INC(emu, H(emu)); break;
-        case 0x25: DEC(emu, H(emu)); break;
-        case 0x26: LD_u8(emu, H(emu)); break;
-        case 0x27: decimal_adjust_accumulator(emu); break;
-        case 0x28: jump_relative_condition(emu, CONDITION_Z(emu)); break;
-        case 0x29: add_u16_RR(emu, emu->HL, emu->HL); break;
-        case 0x2A: LD_R_u8(emu, A(emu), read(emu, HL(emu))); INC_RR(emu, HL(emu)); break;
-        case 0x2B: DEC_RR(emu, HL(emu)); break;
-        case 0x2C: INC(emu, L(emu)); break;
-        case 0x2D: DEC(emu, L(emu)); break;
-        case 0x2E: LD_u8(emu, L(emu)); break;
-        case 0x2F: complement(emu); break;
-
-        case 0x30: jump_relative_condition(emu, CONDITION_NC(emu)); break;
-        case 0x31: LD_u16(emu, emu->SP.entireByte); break;
-        case 0x32: LD_addr_reg(emu, read(emu, HL(emu)), A(emu)); DEC_RR(emu, HL(emu)); break;
-        case 0x33: INC_RR(emu, emu->SP.entireByte); break;
-        case 0x34: {
+        OPCODE(0x11) LD_u16(emu, DE(emu)); NEXT;
+        OPCODE(0x12) LD_addr_reg(emu, read(emu, DE(emu)), A(emu)); NEXT;
+        OPCODE(0x13) INC_RR(emu, DE(emu)); NEXT;
+        OPCODE(0x14) INC(emu, D(emu)); NEXT;
+        OPCODE(0x15) DEC(emu, D(emu)); NEXT;
+        OPCODE(0x16) LD_u8(emu, D(emu)); NEXT;
+        OPCODE(0x17) ROTATE_LEFT(emu, A(emu), false, true); NEXT;
+        OPCODE(0x18) JUMP_RELATIVE(emu, read_u8(emu)); NEXT;
+        OPCODE(0x19) add_u16_RR(emu, emu->HL, emu->DE); NEXT;
+        OPCODE(0x1A) LD_R_u8(emu, A(emu), read(emu, DE(emu))); NEXT;  // LD A, (DE)
+        OPCODE(0x1B) DEC_RR(emu, DE(emu)); NEXT;
+        OPCODE(0x1C) INC(emu, E(emu)); NEXT;
+        OPCODE(0x1D) DEC(emu, E(emu)); NEXT;
+        OPCODE(0x1E) LD_u8(emu, E(emu)); NEXT;
+        OPCODE(0x1F) ROTATE_RIGHT(emu, A(emu), false, true); NEXT;
+
+        OPCODE(0x20) JUMP_RELATIVE_IF(emu, CONDITION_NZ(emu)); NEXT;
+        OPCODE(0x21) LD_u16(emu, HL(emu)); NEXT;
+        OPCODE(0x22) LD_addr_reg(emu, read(emu, HL(emu)), A(emu)); INC_RR(emu, HL(emu)); NEXT;
+        OPCODE(0x23) INC_RR(emu, HL(emu)); NEXT;
+        OPCODE(0x24) INC(emu, H(emu)); NEXT;
+        OPCODE(0x25) DEC(emu, H(emu)); NEXT;
+        OPCODE(0x26) LD_u8(emu, H(emu)); NEXT;
+        OPCODE(0x27) decimal_adjust_accumulator(emu); NEXT;
+        OPCODE(0x28) JUMP_RELATIVE_IF(emu, CONDITION_Z(emu)); NEXT;
+        OPCODE(0x29) add_u16_RR(emu, emu->HL, emu->HL); NEXT;
+        OPCODE(0x2A) LD_R_u8(emu, A(emu), read(emu, HL(emu))); INC_RR(emu, HL(emu)); NEXT;
+        OPCODE(0x2B) DEC_RR(emu, HL(emu)); NEXT;
+        OPCODE(0x2C) INC(emu, L(emu)); NEXT;
+        OPCODE(0x2D) DEC(emu, L(emu)); NEXT;
+        OPCODE(0x2E) LD_u8(emu, L(emu)); NEXT;
+        OPCODE(0x2F) complement(emu); NEXT;
+
+        OPCODE(0x30) JUMP_RELATIVE_IF(emu, CONDITION_NC(emu)); NEXT;
+        OPCODE(0x31) LD_u16(emu, emu->SP.entireByte); NEXT;
+        OPCODE(0x32) LD_addr_reg(emu, read(emu, HL(emu)), A(emu)); DEC_RR(emu, HL(emu)); NEXT;
+        OPCODE(0x33) INC_RR(emu, emu->SP.entireByte); NEXT;
+        OPCODE(0x34) {
             /* INC (HL) */
             u16 addr = HL(emu);
             u8 old = read(emu, addr);
@@ -509,9 +896,9 @@ void dispatch(Emulator* emu){
             set_flagh_addu16(emu, old, 1);
             modify_flag(emu, flag_n, 0);
 
-            break;
+            NEXT;
         }
-        case 0x35: {
+        OPCODE(0x35) {
             /* DEC (HL) */
             u16 addr = HL(emu);
             u8 old = read(emu, addr);
@@ -522,171 +909,211 @@ void dispatch(Emulator* emu){
             set_flagc_subu16(emu, old, 1);
             modify_flag(emu, flag_n, 1);
 
-            break;
+            NEXT;
         }
-        case 0x36: LD_addr_reg(emu, read(emu, HL(emu)), read_u8(emu)); break;
-        case 0x37: {
+        OPCODE(0x36) LD_addr_reg(emu, read(emu, HL(emu)), read_u8(emu)); NEXT;
+        OPCODE(0x37) {
             modify_flag(emu, flag_c, 1);
             modify_flag(emu, flag_n, 0);
             modify_flag(emu, flag_h, 0);
-            break;
+            NEXT;
         }
-        case 0x38: jump_relative_condition(emu, CONDITION_C(emu)); break;
-        case 0x39: add_u16_RR(emu, emu->HL, emu->SP); break;
-        case 0x3A: LD_R_u8(emu, A(emu), read(emu, HL(emu))); DEC_RR(emu, HL(emu)); break;
-        case 0x3B: DEC_RR(emu, emu->SP.entireByte); break;
-        case 0x3C: INC(emu, A(emu)); break;
-        case 0x3D: DEC(emu, A(emu)); break;
-        case 0x3E: LD_u8(emu, A(emu)); break;
-        case 0x3F: complement_carry(emu); break;
-
-        case 0x40: LD_RR(emu, B(emu), B(emu)); break;
-        case 0x41: LD_RR(emu, B(emu), C(emu)); break;
-        case 0x42: LD_RR(emu, B(emu), D(emu)); break;
-        case 0x43: LD_RR(emu, B(emu), E(emu)); break;
-        case 0x44: LD_RR(emu, B(emu), H(emu)); break;
-        case 0x45: LD_RR(emu, B(emu), L(emu)); break;
-        case 0x46: LD_RR(emu, B(emu), read(emu, HL(emu))); break;
-        case 0x47: LD_RR(emu, B(emu), A(emu)); break;
-        case 0x48: LD_RR(emu, C(emu), B(emu)); break;
-        case 0x49: LD_RR(emu, C(emu), C(emu)); break;
-        case 0x4A: LD_RR(emu, C(emu), D(emu)); break;
-        case 0x4B: LD_RR(emu, C(emu), E(emu)); break;
-        case 0x4C: LD_RR(emu, C(emu), H(emu)); break;
-        case 0x4D: LD_RR(emu, C(emu), L(emu)); break;
-        case 0x4E: LD_RR(emu, C(emu), read(emu, HL(emu))); break;
-        case 0x4F: LD_RR(emu, C(emu), A(emu)); break;
-
-        case 0x50: LD_RR(emu, D(emu), B(emu)); break;
-        case 0x51: LD_RR(emu, D(emu), C(emu)); break;
-        case 0x52: LD_RR(emu, D(emu), D(emu)); break;
-        case 0x53: LD_RR(emu, D(emu), E(emu)); break;
-        case 0x54: LD_RR(emu, D(emu), H(emu)); break;
-        case 0x55: LD_RR(emu, D(emu), L(emu)); break;
-        case 0x56: LD_RR(emu, D(emu), read(emu, HL(emu))); break;
-        case 0x57: LD_RR(emu, D(emu), A(emu)); break;
-        case 0x58: LD_RR(emu, E(emu), B(emu)); break;
-        case 0x59: LD_RR(emu, E(emu), C(emu)); break;
-        case 0x5A: LD_RR(emu, E(emu), D(emu)); break;
-        case 0x5B: LD_RR(emu, E(emu), E(emu)); break;
-        case 0x5C: LD_RR(emu, E(emu), H(emu)); break;
-        case 0x5D: LD_RR(emu, E(emu), L(emu)); break;
-        case 0x5E: LD_RR(emu, E(emu), read(emu, HL(emu))); break;
-        case 0x5F: LD_RR(emu, E(emu), A(emu)); break;
-
-        case 0x60: LD_RR(emu, H(emu), B(emu)); break;
-        case 0x61: LD_RR(emu, H(emu), C(emu)); break;
-        case 0x62: LD_RR(emu, H(emu), D(emu)); break;
-        case 0x63: LD_RR(emu, H(emu), E(emu)); break;
-        case 0x64: LD_RR(emu, H(emu), H(emu)); break;
-        case 0x65: LD_RR(emu, H(emu), L(emu)); break;
-        case 0x66: LD_RR(emu, H(emu), read(emu, HL(emu))); break;
-        case 0x67: LD_RR(emu, H(emu), A(emu)); break;
-        case 0x68: LD_RR(emu, L(emu), B(emu)); break;
-        case 0x69: LD_RR(emu, L(emu), C(emu)); break;
-        case 0x6A: LD_RR(emu, L(emu), D(emu)); break;
-        case 0x6B: LD_RR(emu, L(emu), E(emu)); break;
-        case 0x6C: LD_RR(emu, L(emu), H(emu)); break;
-        case 0x6D: LD_RR(emu, L(emu), L(emu)); break;
-        case 0x6E: LD_RR(emu, L(emu), read(emu, HL(emu))); break;
-        case 0x6F: LD_RR(emu, L(emu), A(emu)); break;
-
-        case 0x70: LD_u16_R(emu, HL(emu), B(emu)); break;
-        case 0x71: LD_u16_R(emu, HL(emu), C(emu)); break;
-        case 0x72: LD_u16_R(emu, HL(emu), D(emu)); break;
-        case 0x73: LD_u16_R(emu, HL(emu), E(emu)); break;
-        case 0x74: LD_u16_R(emu, HL(emu), H(emu)); break;
-        case 0x75: LD_u16_R(emu, HL(emu), L(emu)); break;
-        case 0x76: halt_emulator(emu); break;
-        case 0x77: LD_u16_R(emu, HL(emu), A(emu)); break;
-        case 0x78: LD_RR(emu, A(emu), B(emu)); break;
-        case 0x79: LD_RR(emu, A(emu), C(emu)); break;
-        case 0x7A: LD_RR(emu, A(emu), D(emu)); break;
-        case 0x7B: LD_RR(emu, A(emu), E(emu)); break;
-        case 0x7C: LD_RR(emu, A(emu), H(emu)); break;
-        case 0x7D: LD_RR(emu, A(emu), L(emu)); break;
-        case 0x7E: LD_RR(emu, A(emu), read(emu, HL(emu))); break;
-        case 0x7F: LD_RR(emu, A(emu), A(emu)); break;
-
-        case 0x80: A(emu) = add_u8_u8(emu, A(emu), B(emu)); break;
-        case 0x81: A(emu) = add_u8_u8(emu, A(emu), C(emu)); break;
-        case 0x82: A(emu) = add_u8_u8(emu, A(emu), D(emu)); break;
-        case 0x83: A(emu) = add_u8_u8(emu, A(emu), E(emu)); break;
-        case 0x84: A(emu) = add_u8_u8(emu, A(emu), H(emu)); break;
-        case 0x85: A(emu) = add_u8_u8(emu, A(emu), L(emu)); break;
-        case 0x86: A(emu) = add_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0x87: A(emu) = add_u8_u8(emu, A(emu), A(emu)); break;
-        case 0x88: A(emu) = adc_u8_u8(emu, A(emu), B(emu)); break;
-        case 0x89: A(emu) = adc_u8_u8(emu, A(emu), C(emu)); break;
-        case 0x8A: A(emu) = adc_u8_u8(emu, A(emu), D(emu)); break;
-        case 0x8B: A(emu) = adc_u8_u8(emu, A(emu), E(emu)); break;
-        case 0x8C: A(emu) = adc_u8_u8(emu, A(emu), H(emu)); break;
-        case 0x8D: A(emu) = adc_u8_u8(emu, A(emu), L(emu)); break;
-        case 0x8E: A(emu) = adc_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0x8F: A(emu) = adc_u8_u8(emu, A(emu), A(emu)); break;
-
-        case 0x90: A(emu) = sub_u8_u8(emu, A(emu), B(emu)); break;
-        case 0x91: A(emu) = sub_u8_u8(emu, A(emu), C(emu)); break;
-        case 0x92: A(emu) = sub_u8_u8(emu, A(emu), D(emu)); break;
-        case 0x93: A(emu) = sub_u8_u8(emu, A(emu), E(emu)); break;
-        case 0x94: A(emu) = sub_u8_u8(emu, A(emu), H(emu)); break;
-        case 0x95: A(emu) = sub_u8_u8(emu, A(emu), L(emu)); break;
-        case 0x96: A(emu) = sub_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0x97: A(emu) = sub_u8_u8(emu, A(emu), A(emu)); break;
-        case 0x98: A(emu) = sbc_u8_u8(emu, A(emu), B(emu)); break;
-        case 0x99: A(emu) = sbc_u8_u8(emu, A(emu), C(emu)); break;
-        case 0x9A: A(emu) = sbc_u8_u8(emu, A(emu), D(emu)); break;
-        case 0x9B: A(emu) = sbc_u8_u8(emu, A(emu), E(emu)); break;
-        case 0x9C: A(emu) = sbc_u8_u8(emu, A(emu), H(emu)); break;
-        case 0x9D: A(emu) = sbc_u8_u8(emu, A(emu), L(emu)); break;
-        case 0x9E: A(emu) = sbc_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0x9F: A(emu) = sbc_u8_u8(emu, A(emu), A(emu)); break;
-
-        case 0xA0: A(emu) = and_u8_u8(emu, A(emu), B(emu)); break;
-        case 0xA1: A(emu) = and_u8_u8(emu, A(emu), C(emu)); break;
-        case 0xA2: A(emu) = and_u8_u8(emu, A(emu), D(emu)); break;
-        case 0xA3: A(emu) = and_u8_u8(emu, A(emu), E(emu)); break;
-        case 0xA4: A(emu) = and_u8_u8(emu, A(emu), H(emu)); break;
-        case 0xA5: A(emu) = and_u8_u8(emu, A(emu), L(emu)); break;
-        case 0xA6: A(emu) = and_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0xA7: A(emu) = and_u8_u8(emu, A(emu), A(emu)); break;
-        case 0xA8: A(emu) = xor_u8_u8(emu, A(emu), B(emu)); break;
-        case 0xA9: A(emu) = xor_u8_u8(emu, A(emu), C(emu)); break;
-        case 0xAA: A(emu) = xor_u8_u8(emu, A(emu), D(emu)); break;
-        case 0xAB: A(emu) = xor_u8_u8(emu, A(emu), E(emu)); break;
-        case 0xAC: A(emu) = xor_u8_u8(emu, A(emu), H(emu)); break;
-        case 0xAD: A(emu) = xor_u8_u8(emu, A(emu), L(emu)); break;
-        case 0xAE: A(emu) = xor_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0xAF: A(emu) = xor_u8_u8(emu, A(emu), A(emu)); break;
-
-        case 0xB0: A(emu) = or_u8_u8(emu, A(emu), B(emu)); break;
-        case 0xB1: A(emu) = or_u8_u8(emu, A(emu), C(emu)); break;
-        case 0xB2: A(emu) = or_u8_u8(emu, A(emu), D(emu)); break;
-        case 0xB3: A(emu) = or_u8_u8(emu, A(emu), E(emu)); break;
-        case 0xB4: A(emu) = or_u8_u8(emu, A(emu), H(emu)); break;
-        case 0xB5: A(emu) = or_u8_u8(emu, A(emu), L(emu)); break;
-        case 0xB6: A(emu) = or_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0xB7: A(emu) = or_u8_u8(emu, A(emu), A(emu)); break;
-        case 0xB8: cp_u8_u8(emu, A(emu), B(emu)); break;
-        case 0xB9: cp_u8_u8(emu, A(emu), C(emu)); break;
-        case 0xBA: cp_u8_u8(emu, A(emu), D(emu)); break;
-        case 0xBB: cp_u8_u8(emu, A(emu), E(emu)); break;
-        case 0xBC: cp_u8_u8(emu, A(emu), H(emu)); break;
-        case 0xBD: cp_u8_u8(emu, A(emu), L(emu)); break;
-        case 0xBE: cp_u8_u8(emu, A(emu), read(emu, HL(emu))); break;
-        case 0xBF: cp_u8_u8(emu, A(emu), A(emu)); break;
-
-        case 0xC3: {
+        OPCODE(0x38) JUMP_RELATIVE_IF(emu, CONDITION_C(emu)); NEXT;
+        OPCODE(0x39) add_u16_RR(emu, emu->HL, emu->SP); NEXT;
+        OPCODE(0x3A) LD_R_u8(emu, A(emu), read(emu, HL(emu))); DEC_RR(emu, HL(emu)); NEXT;
+        OPCODE(0x3B) DEC_RR(emu, emu->SP.entireByte); NEXT;
+        OPCODE(0x3C) INC(emu, A(emu)); NEXT;
+        OPCODE(0x3D) DEC(emu, A(emu)); NEXT;
+        OPCODE(0x3E) LD_u8(emu, A(emu)); NEXT;
+        OPCODE(0x3F) complement_carry(emu); NEXT;
+
+        OPCODE(0x40) LD_RR(emu, B(emu), B(emu)); NEXT;
+        OPCODE(0x41) LD_RR(emu, B(emu), C(emu)); NEXT;
+        OPCODE(0x42) LD_RR(emu, B(emu), D(emu)); NEXT;
+        OPCODE(0x43) LD_RR(emu, B(emu), E(emu)); NEXT;
+        OPCODE(0x44) LD_RR(emu, B(emu), H(emu)); NEXT;
+        OPCODE(0x45) LD_RR(emu, B(emu), L(emu)); NEXT;
+        OPCODE(0x46) LD_RR(emu, B(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x47) LD_RR(emu, B(emu), A(emu)); NEXT;
+        OPCODE(0x48) LD_RR(emu, C(emu), B(emu)); NEXT;
+        OPCODE(0x49) LD_RR(emu, C(emu), C(emu)); NEXT;
+        OPCODE(0x4A) LD_RR(emu, C(emu), D(emu)); NEXT;
+        OPCODE(0x4B) LD_RR(emu, C(emu), E(emu)); NEXT;
+        OPCODE(0x4C) LD_RR(emu, C(emu), H(emu)); NEXT;
+        OPCODE(0x4D) LD_RR(emu, C(emu), L(emu)); NEXT;
+        OPCODE(0x4E) LD_RR(emu, C(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x4F) LD_RR(emu, C(emu), A(emu)); NEXT;
+
+        OPCODE(0x50) LD_RR(emu, D(emu), B(emu)); NEXT;
+        OPCODE(0x51) LD_RR(emu, D(emu), C(emu)); NEXT;
+        OPCODE(0x52) LD_RR(emu, D(emu), D(emu)); NEXT;
+        OPCODE(0x53) LD_RR(emu, D(emu), E(emu)); NEXT;
+        OPCODE(0x54) LD_RR(emu, D(emu), H(emu)); NEXT;
+        OPCODE(0x55) LD_RR(emu, D(emu), L(emu)); NEXT;
+        OPCODE(0x56) LD_RR(emu, D(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x57) LD_RR(emu, D(emu), A(emu)); NEXT;
+        OPCODE(0x58) LD_RR(emu, E(emu), B(emu)); NEXT;
+        OPCODE(0x59) LD_RR(emu, E(emu), C(emu)); NEXT;
+        OPCODE(0x5A) LD_RR(emu, E(emu), D(emu)); NEXT;
+        OPCODE(0x5B) LD_RR(emu, E(emu), E(emu)); NEXT;
+        OPCODE(0x5C) LD_RR(emu, E(emu), H(emu)); NEXT;
+        OPCODE(0x5D) LD_RR(emu, E(emu), L(emu)); NEXT;
+        OPCODE(0x5E) LD_RR(emu, E(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x5F) LD_RR(emu, E(emu), A(emu)); NEXT;
+
+        OPCODE(0x60) LD_RR(emu, H(emu), B(emu)); NEXT;
+        OPCODE(0x61) LD_RR(emu, H(emu), C(emu)); NEXT;
+        OPCODE(0x62) LD_RR(emu, H(emu), D(emu)); NEXT;
+        OPCODE(0x63) LD_RR(emu, H(emu), E(emu)); NEXT;
+        OPCODE(0x64) LD_RR(emu, H(emu), H(emu)); NEXT;
+        OPCODE(0x65) LD_RR(emu, H(emu), L(emu)); NEXT;
+        OPCODE(0x66) LD_RR(emu, H(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x67) LD_RR(emu, H(emu), A(emu)); NEXT;
+        OPCODE(0x68) LD_RR(emu, L(emu), B(emu)); NEXT;
+        OPCODE(0x69) LD_RR(emu, L(emu), C(emu)); NEXT;
+        OPCODE(0x6A) LD_RR(emu, L(emu), D(emu)); NEXT;
+        OPCODE(0x6B) LD_RR(emu, L(emu), E(emu)); NEXT;
+        OPCODE(0x6C) LD_RR(emu, L(emu), H(emu)); NEXT;
+        OPCODE(0x6D) LD_RR(emu, L(emu), L(emu)); NEXT;
+        OPCODE(0x6E) LD_RR(emu, L(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x6F) LD_RR(emu, L(emu), A(emu)); NEXT;
+
+        OPCODE(0x70) LD_u16_R(emu, HL(emu), B(emu)); NEXT;
+        OPCODE(0x71) LD_u16_R(emu, HL(emu), C(emu)); NEXT;
+        OPCODE(0x72) LD_u16_R(emu, HL(emu), D(emu)); NEXT;
+        OPCODE(0x73) LD_u16_R(emu, HL(emu), E(emu)); NEXT;
+        OPCODE(0x74) LD_u16_R(emu, HL(emu), H(emu)); NEXT;
+        OPCODE(0x75) LD_u16_R(emu, HL(emu), L(emu)); NEXT;
+        OPCODE(0x76) halt_emulator(emu); NEXT;
+        OPCODE(0x77) LD_u16_R(emu, HL(emu), A(emu)); NEXT;
+        OPCODE(0x78) LD_RR(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0x79) LD_RR(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0x7A) LD_RR(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0x7B) LD_RR(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0x7C) LD_RR(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0x7D) LD_RR(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0x7E) LD_RR(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x7F) LD_RR(emu, A(emu), A(emu)); NEXT;
+
+        OPCODE(0x80) A(emu) = add_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0x81) A(emu) = add_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0x82) A(emu) = add_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0x83) A(emu) = add_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0x84) A(emu) = add_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0x85) A(emu) = add_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0x86) A(emu) = add_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x87) A(emu) = add_u8_u8(emu, A(emu), A(emu)); NEXT;
+        OPCODE(0x88) A(emu) = adc_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0x89) A(emu) = adc_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0x8A) A(emu) = adc_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0x8B) A(emu) = adc_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0x8C) A(emu) = adc_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0x8D) A(emu) = adc_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0x8E) A(emu) = adc_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x8F) A(emu) = adc_u8_u8(emu, A(emu), A(emu)); NEXT;
+
+        OPCODE(0x90) A(emu) = sub_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0x91) A(emu) = sub_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0x92) A(emu) = sub_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0x93) A(emu) = sub_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0x94) A(emu) = sub_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0x95) A(emu) = sub_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0x96) A(emu) = sub_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x97) A(emu) = sub_u8_u8(emu, A(emu), A(emu)); NEXT;
+        OPCODE(0x98) A(emu) = sbc_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0x99) A(emu) = sbc_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0x9A) A(emu) = sbc_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0x9B) A(emu) = sbc_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0x9C) A(emu) = sbc_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0x9D) A(emu) = sbc_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0x9E) A(emu) = sbc_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0x9F) A(emu) = sbc_u8_u8(emu, A(emu), A(emu)); NEXT;
+
+        OPCODE(0xA0) A(emu) = and_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0xA1) A(emu) = and_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0xA2) A(emu) = and_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0xA3) A(emu) = and_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0xA4) A(emu) = and_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0xA5) A(emu) = and_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0xA6) A(emu) = and_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0xA7) A(emu) = and_u8_u8(emu, A(emu), A(emu)); NEXT;
+        OPCODE(0xA8) A(emu) = xor_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0xA9) A(emu) = xor_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0xAA) A(emu) = xor_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0xAB) A(emu) = xor_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0xAC) A(emu) = xor_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0xAD) A(emu) = xor_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0xAE) A(emu) = xor_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0xAF) A(emu) = xor_u8_u8(emu, A(emu), A(emu)); NEXT;
+
+        OPCODE(0xB0) A(emu) = or_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0xB1) A(emu) = or_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0xB2) A(emu) = or_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0xB3) A(emu) = or_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0xB4) A(emu) = or_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0xB5) A(emu) = or_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0xB6) A(emu) = or_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0xB7) A(emu) = or_u8_u8(emu, A(emu), A(emu)); NEXT;
+        OPCODE(0xB8) cp_u8_u8(emu, A(emu), B(emu)); NEXT;
+        OPCODE(0xB9) cp_u8_u8(emu, A(emu), C(emu)); NEXT;
+        OPCODE(0xBA) cp_u8_u8(emu, A(emu), D(emu)); NEXT;
+        OPCODE(0xBB) cp_u8_u8(emu, A(emu), E(emu)); NEXT;
+        OPCODE(0xBC) cp_u8_u8(emu, A(emu), H(emu)); NEXT;
+        OPCODE(0xBD) cp_u8_u8(emu, A(emu), L(emu)); NEXT;
+        OPCODE(0xBE) cp_u8_u8(emu, A(emu), read(emu, HL(emu))); NEXT;
+        OPCODE(0xBF) cp_u8_u8(emu, A(emu), A(emu)); NEXT;
+
+        OPCODE(0xC3) {
+            u16 from = emu->PC.entireByte;
             u16 stuff = read_u16(emu); 
             emu->PC.entireByte = stuff;
-            break;
+            IDLE_BRANCH(emu, from, max_instructions);
+            NEXT;
+        }
+        OPCODE(0xCB) execute_cb(emu); NEXT;
+        OPCODE(0xCE) A(emu) = adc_u8_u8(emu, A(emu), read_u8(emu)); NEXT;
+
+        OPCODE(0xD9) {
+            /* RETI */
+            emu->PC.entireByte = pop_u16(emu) - 1;
+            emu->ime = true;
+            schedule(emu, EVENT_INTERRUPT, emu->cycles);
+            NEXT;
+        }
+
+        OPCODE(0xF3) emu->ime = false; NEXT;
+        OPCODE(0xFB) {
+            /* EI: takes effect right after this instruction (hardware waits one more) */
+            emu->ime = true;
+            schedule(emu, EVENT_INTERRUPT, emu->cycles);
+            NEXT;
         }
-        case 0xCE: A(emu) = adc_u8_u8(emu, A(emu), read_u8(emu)); break;
         
-        default: {
-            printf("This instruction hasn't been implemented yet.\n");
-            emu->run = false;
-            break;
+        UNIMPLEMENTED {
+            char message[64];
+            snprintf(message, sizeof(message), "Instruction 0x%02x at 0x%04x hasn't been implemented yet.",
+                opcode, emu->PC.entireByte);
+            log_fatal(emu, EMU_ERROR_UNIMPLEMENTED, message);
+            NEXT;
+        }
+#ifndef THREADED_DISPATCH
+        }
+    }
+#endif
+}
+
+void dispatch(Emulator* emu){
+    /* One instruction. While halted, one idle skip up to the next event instead, so a step
+     * always returns: nothing happens when no event is scheduled. */
+    uint64_t until = UINT64_MAX;
+
+    if (emu->halted){
+        run_events(emu);    /* May deliver the interrupt that wakes it */
+        if (emu->halted){
+            until = next_event(&emu->scheduler);
+            if (until == UINT64_MAX) return;
         }
     }
+
+    execute(emu, until, emu->instructions + 1);
 }
@@ -41,9 +41,18 @@ typedef enum {
     INTERRUPT_ENABLE = 0xFFFF          // Interrupt Enable register (IE)
 } addresses;
 
-void Start(Cartridge* cart, Emulator* emu);
+#define DEFAULT_INSTRUCTION_LIMIT 2074879
+
+#define CPU_CLOCK_HZ 4194304
+#define CYCLES_PER_FRAME 70224      /* 154 lines of 456 T-cycles */
+
+void Start(Cartridge* cart, Emulator* emu, uint64_t max_cycles, uint64_t max_instructions);
+uint64_t run_cycles(Emulator* emu, uint64_t cycles);
+void run_frame(Emulator* emu);
 void dispatch(Emulator* emu);
 
+void map_pages(u8** map, u16 start, u16 end, u8* base);
+void map_memory(Emulator* emu);
 u8 read(Emulator* emu, u16 addr);
 
 #endif
\ No newline at end of file
@@ -3,7 +3,15 @@
 
 #include "cpu.h"
 
+#define DISASM_LENGTH 32
+
+void log_fatal(Emulator* emu, emu_error error, const char* string);
+void log_warning(Emulator* emu, const char* string);
+
+void disassemble(const uint8_t* op, char* out);
+bool assemble(const char* text, uint8_t* op);
+void opcode_name(uint8_t opcode, bool cb, char* out);
 void printInstruction(Emulator* emu);
 void printRegisters(Emulator* emu);
 
-#endif
\ No newline at end of file
+#endif
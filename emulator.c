@@ -1,6 +1,10 @@
 #include "emulator.h"
+#include "cpu.h"
+#include "io.h"
 
 Emulator* initEmulator(Emulator* emu){    
+    memset(emu, 0, sizeof(Emulator));
+
     emu->AF.bytes.higher = 0x11;
     emu->AF.bytes.lower = 0x0000;
 
@@ -16,12 +20,73 @@ Emulator* initEmulator(Emulator* emu){
     emu->SP.entireByte = 0xfffe;
     
     emu->run = false;
+    emu->idle.enabled = true;
+
+    ppu_init(emu);
+    init_io(emu);
+
+    return emu;
+}
+
+Emulator* createEmulator(Cartridge* cart){
+    /* Returns an instance ready to run cart, or NULL when out of memory. The cartridge has to
+     * outlive the instance and can be shared between instances. */
+    Emulator* emu = (Emulator*)malloc(sizeof(Emulator));
+    if (emu == NULL) return NULL;
+
+    initEmulator(emu);
+
+    emu->cart = cart;
+    emu->run = true;
+
+    init_mbc(emu);
+    map_memory(emu);
+
+    return emu;
+}
+
+void destroyEmulator(Emulator* emu){
+    free(emu);
+}
+
+emu_error emulator_step(Emulator* emu){
+    /* Executes one instruction, or while halted idles to the next event (and returns without
+     * advancing when nothing is scheduled). */
+    if (emu->error == EMU_OK) dispatch(emu);
+
+    return emu->error;
+}
+
+emu_error emulator_run(Emulator* emu, uint64_t cycles){
+    /* Runs for cycles T-cycles, stopping early on an error. */
+    if (emu->error == EMU_OK) run_cycles(emu, cycles);
+
+    return emu->error;
+}
+
+void emulator_set_render(Emulator* emu, uint32_t every){
+    /* Takes effect from the next frame */
+    emu->ppu.render_every = every;
+}
+
+void emulator_request_frame(Emulator* emu){
+    emu->ppu.render_next = true;
+}
+
+void emulator_set_audio(Emulator* emu, void (*hook)(Emulator* emu, const int16_t* samples, size_t count)){
+    apu_flush(emu);
+
+    emu->audio_hook = hook;
+    emu->apu.enabled = hook != NULL;
+    if (emu->apu.enabled) apu_start(emu);
 }
 
 void modify_flag(Emulator* emu, flags flag, u8 value){
+    if (emu->lazy.op != FLAGS_RESOLVED) resolve_flags(emu);
     emu->AF.bytes.lower &= ~(1 << flag); emu->AF.bytes.lower |= value << flag;
 }
 
 u8 getflag(Emulator* emu, flags flag){
+    if (emu->lazy.op != FLAGS_RESOLVED) resolve_flags(emu);
     return (emu->AF.bytes.lower >> (flag + 4) & 1);
 }
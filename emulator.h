@@ -2,6 +2,10 @@
 #define gbc_emulator
 
 #include "cartridge.h"
+#include "scheduler.h"
+#include "ppu.h"
+#include "apu.h"
+#include "mbc.h"
 
 #define A(emu) emu->AF.bytes.higher
 #define F(emu) emu->AF.bytes.lower
@@ -36,29 +40,202 @@ typedef enum {
 } flags;
 typedef Register res;
 
+/* Lazy flags: the ALU helpers only record what they did and F is worked out the first time
+ * something reads it (see resolve_flags in cpu.c). Ops before FLAGS_PARTIAL overwrite all
+ * of Z/N/H/C, the ones after it only some, so those need the previous F resolved first. */
 typedef enum {
-    R_SC = 0x01,
-    R_SB = 0x02
-} io_reg_addr;
+    FLAGS_RESOLVED,
+    FLAGS_ADD,
+    FLAGS_ADC,
+    FLAGS_SUB,
+    FLAGS_SBC,
+    FLAGS_AND,
+    FLAGS_XOR,
+    FLAGS_OR,
+    FLAGS_ROTATE,
+
+    FLAGS_PARTIAL,
+    FLAGS_CP = FLAGS_PARTIAL,
+    FLAGS_INC,
+    FLAGS_DEC
+} flag_op;
+
+typedef struct {
+    u8 op;            /* flag_op, FLAGS_RESOLVED when F is up to date */
+    u8 val1, val2;    /* Operands */
+    u8 result;
+    u8 carry;         /* Carry in for ADC/SBC, bit shifted out for rotates */
+} LazyFlags;
 
+/* Idle loop detection, see idle.c. The backward branch being watched is compared with the
+ * last time it was taken, in the same block. */
 typedef struct {
+    bool enabled;               /* On by default, off for ROMs the detection gets wrong */
+    bool watching;
+    bool rejected;              /* The loop was looked at and is not idle */
+    u16 branch;                 /* Address of the branch */
+    res registers[5];           /* AF BC DE HL SP when it was last taken */
+    LazyFlags lazy;
+    uint64_t instructions;
+    uint64_t cycles;
+
+    uint64_t skips;             /* Loops fast-forwarded */
+    uint64_t skipped_cycles;
+    uint64_t skipped_instructions;
+} IdleLoop;
+
+typedef struct Trace Trace;
+typedef struct Profile Profile;
+
+typedef enum {
+    R_P1_JOYP = 0x00,
+    R_SB = 0x01,
+    R_SC = 0x02,
+    R_DIV = 0x04,
+    R_TIMA = 0x05,
+    R_TMA = 0x06,
+    R_TAC = 0x07,
+    R_IF = 0x0F,
+    R_NR10 = 0x10,
+    R_NR11 = 0x11,
+    R_NR12 = 0x12,
+    R_NR13 = 0x13,
+    R_NR14 = 0x14,
+    R_NR21 = 0x16,
+    R_NR22 = 0x17,
+    R_NR23 = 0x18,
+    R_NR24 = 0x19,
+    R_NR30 = 0x1A,
+    R_NR31 = 0x1B,
+    R_NR32 = 0x1C,
+    R_NR33 = 0x1D,
+    R_NR34 = 0x1E,
+    R_NR41 = 0x20,
+    R_NR42 = 0x21,
+    R_NR43 = 0x22,
+    R_NR44 = 0x23,
+    R_NR50 = 0x24,
+    R_NR51 = 0x25,
+    R_NR52 = 0x26,
+    R_WAVE = 0x30,              /* Wave RAM, to 0x3F */
+    R_LCDC = 0x40,
+    R_STAT = 0x41,
+    R_SCY = 0x42,
+    R_SCX = 0x43,
+    R_LY = 0x44,
+    R_LYC = 0x45,
+    R_DMA = 0x46,
+    R_BGP = 0x47,
+    R_OBP0 = 0x48,
+    R_OBP1 = 0x49,
+    R_WY = 0x4A,
+    R_WX = 0x4B
+} io_reg_addr;
+
+/* Why an instance stopped running. Once set, it stays set: the instance has to be
+ * destroyed (or re-initialised). */
+typedef enum {
+    EMU_OK,
+    EMU_ERROR_UNIMPLEMENTED,    /* Hit an opcode the core does not implement */
+    EMU_ERROR_FATAL             /* Anything else reported through log_fatal */
+} emu_error;
+
+typedef enum {
+    LOG_WARNING,
+    LOG_FATAL
+} log_level;
+
+#define BULK_SIZE (0x4000 + ERAM_MAX)     /* vram through eram */
+#define BULK_PAGES (BULK_SIZE >> 8)
+
+#define MARK_DIRTY(emu, host) (emu)->dirty[((host) - (emu)->vram) >> 8] = 1
+
+typedef struct Emulator {
     /* Registers */
     
     res AF, BC, DE, HL, SP, PC;
+    LazyFlags lazy;
 
+    /* Bulk memory, contiguous on purpose: the dirty flags below index it by page */
     u8 vram[0x2000];  /* 8 kb */
     u8 wram1[0x1000]; /* wram1 + wram2 = 8 kb */
     u8 wram2[0x1000];
-    u8 hram[0x7f]; /*  */
-    u8 IO[0x80]; 
+    u8 eram[ERAM_MAX];  /* Cartridge RAM, only the first mbc.ram_size bytes are used */
+
+    /* One flag per 256-byte page of bulk memory, set by every write to it and cleared when a
+     * snapshot is taken (see snapshot.c) */
+    u8 dirty[BULK_PAGES];
+
+    u8 oam[0xA0];     /* Sprite attributes, kept with the core state (see ppu.c) */
+
+    /* 0xFF00 ~ 0xFFFF as one page, so the memory map can point straight at it */
+    union {
+        u8 high[0x100];
+        struct {
+            u8 IO[0x80];
+            u8 hram[0x7f];
+            u8 IE;
+        };
+    };
+
+    /* Memory map: one host pointer per 256-byte page of the address space. NULL sends
+     * the access through the slow path in cpu.c (IO, OAM and anything not mapped). */
+    u8* read_map[0x100];
+    u8* write_map[0x100];
 
     bool run;
+    emu_error error;       /* Set when run was cleared by an error */
+    bool ime;              /* Interrupt master enable */
+    bool halted;           /* HALT / STOP: waiting for an interrupt */
+    uint64_t instructions; /* Dispatched since init */
+    uint64_t cycles;       /* T-cycles since init */
+    uint64_t halted_cycles; /* Part of cycles skipped while halted */
+    IdleLoop idle;          /* Polling loops fast-forwarded, see idle.c */
+
+    /* Peripherals, see io.c */
+    Scheduler scheduler;
+    uint64_t block_end;     /* Cycle the running block stops at, lowered by schedule() */
+    uint64_t div_base;      /* Cycle the internal divider was last reset at */
+    uint64_t tima_overflow; /* Cycle of the next TIMA overflow while the timer runs */
+    uint64_t lcd_base;      /* Cycle the current LCD frame started at */
+    u8 serial_out;          /* Byte being shifted out over the link port */
+    Ppu ppu;                /* Renderer and framebuffer, see ppu.c */
+    Apu apu;                /* Sound, see apu.c */
 
     Cartridge* cart;
+    Mapper mbc;       /* Bank registers of the cartridge, see mbc.c */
+    Trace* trace;     /* Instruction recorder, NULL when not tracing */
+    Profile* profile; /* Instruction profiler (gbc-profile only), NULL when not profiling */
+
+    /* Output sinks. Each instance has its own, NULL falls back to stdout. */
+    void (*serial_hook)(struct Emulator* emu, u8 byte);     /* Every byte sent over the link port */
+    void (*log_hook)(struct Emulator* emu, log_level level, const char* message);
+    void (*audio_hook)(struct Emulator* emu, const int16_t* samples, size_t count);    /* count stereo pairs at APU_RATE */
+    void* user;       /* Owner's data for the hooks */
 } Emulator;
 
 Emulator* initEmulator(Emulator* emu);
+
+/* Instance API. An instance only touches its own state (and the cartridge, read only), so
+ * any number of them can run at once on different threads. */
+Emulator* createEmulator(Cartridge* cart);
+void destroyEmulator(Emulator* emu);
+emu_error emulator_step(Emulator* emu);
+emu_error emulator_run(Emulator* emu, uint64_t cycles);
+
+/* Rendering, every frame by default. every is 1 for every frame, N for one frame in N (turbo)
+ * and 0 for none at all (headless); emulation, LY / STAT timing and interrupts are the same
+ * either way. emulator_request_frame has the next frame that starts drawn regardless. */
+void emulator_set_render(Emulator* emu, uint32_t every);
+void emulator_request_frame(Emulator* emu);
+
+/* Audio, off by default. With a hook, samples are synthesised once per frame (as it is drawn,
+ * see above) and passed to it; apu_flush hands over what is left before stopping. NULL turns
+ * audio off again. */
+void emulator_set_audio(Emulator* emu, void (*hook)(Emulator* emu, const int16_t* samples, size_t count));
+
 void modify_flag(Emulator* emu, flags flag, u8 val);
 u8 getflag(Emulator* emu, flags flag);
+void resolve_flags(Emulator* emu);
 
 #endif
\ No newline at end of file
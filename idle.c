@@ -0,0 +1,217 @@
+#include "idle.h"
+#include "cpu.h"
+#include "io.h"
+#include "tracefile.h"
+
+/* B, C, D, E, H and L as far as they are known while walking a loop body (A is never needed
+ * for an address). Indexes follow the opcode encoding. */
+typedef struct {
+    u8 value[6];
+    bool known[6];
+} Registers;
+
+static void remember(IdleLoop* idle, Emulator* emu){
+    idle->registers[0] = emu->AF;
+    idle->registers[1] = emu->BC;
+    idle->registers[2] = emu->DE;
+    idle->registers[3] = emu->HL;
+    idle->registers[4] = emu->SP;
+    idle->lazy = emu->lazy;
+    idle->instructions = emu->instructions;
+    idle->cycles = emu->cycles;
+}
+
+static bool same_registers(IdleLoop* idle, Emulator* emu){
+    return idle->registers[0].entireByte == emu->AF.entireByte && idle->registers[1].entireByte == emu->BC.entireByte &&
+        idle->registers[2].entireByte == emu->DE.entireByte && idle->registers[3].entireByte == emu->HL.entireByte &&
+        idle->registers[4].entireByte == emu->SP.entireByte && idle->lazy.op == emu->lazy.op &&
+        idle->lazy.val1 == emu->lazy.val1 && idle->lazy.val2 == emu->lazy.val2 &&
+        idle->lazy.result == emu->lazy.result && idle->lazy.carry == emu->lazy.carry;
+}
+
+static void forget(Registers* regs, int index){
+    if (index < 6) regs->known[index] = false;
+}
+
+static void set(Registers* regs, int index, u8 value){
+    if (index < 6){
+        regs->value[index] = value;
+        regs->known[index] = true;
+    }
+}
+
+static bool pair(Registers* regs, int high, u16* address){
+    if (!regs->known[high] || !regs->known[high + 1]) return false;
+
+    *address = (regs->value[high] << 8) | regs->value[high + 1];
+    return true;
+}
+
+static bool stable_read(Emulator* emu, u16 address, uint64_t from, uint64_t* change){
+    /* Lowers change to the first cycle after from at which reading address may give
+     * something else. Plain memory only changes when written, reads that go to a mapper
+     * (RTC registers) or to nothing at all are not predicted. */
+    uint64_t until;
+
+    if (emu->read_map[address >> 8] != NULL || address >= HIGH_RAM) until = UINT64_MAX;
+    else if (address >= IO_REGISTERS) until = io_next_change(emu, address - IO_REGISTERS, from);
+    else return false;
+
+    if (until < *change) *change = until;
+    return true;
+}
+
+static uint64_t loop_body(Emulator* emu, u16 start, u16 branch, uint64_t from, uint64_t* change){
+    /* Walks the loop from start up to the branch that closed it. Returns its length in
+     * instructions (branch included), or 0 if it is not an idle loop. */
+    Registers regs;
+    uint64_t count = 0;
+    u16 pc = start;
+
+    set(&regs, 0, B(emu)); set(&regs, 1, C(emu));
+    set(&regs, 2, D(emu)); set(&regs, 3, E(emu));
+    set(&regs, 4, H(emu)); set(&regs, 5, L(emu));
+
+    while (pc != branch){
+        if (++ count == IDLE_MAX_BODY) return 0;
+
+        u8 op = read(emu, pc);
+        u8 operand = read(emu, pc + 1);
+        u8 x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+        u16 address;
+        bool reads = false;
+
+        if (op == 0x76) return 0;   /* HALT */
+        else if (x == 1){
+            /* LD r,r' */
+            if (y == 6) return 0;
+            if (z == 6){
+                if (!pair(&regs, 4, &address)) return 0;
+                reads = true;
+                forget(&regs, y);
+            }
+            else if (z < 6 && y < 6 && regs.known[z]) set(&regs, y, regs.value[z]);
+            else forget(&regs, y);
+        }
+        else if (x == 2){
+            /* ALU A,r */
+            if (z == 6){
+                if (!pair(&regs, 4, &address)) return 0;
+                reads = true;
+            }
+        }
+        else if (x == 0){
+            switch (z){
+                case 0: {
+                    if (op == 0x00) break;
+                    if ((op & 0xE7) != 0x20) return 0;
+
+                    /* JR cc out of the loop, which the last iteration did not take */
+                    u16 target = pc + 2 + (int8_t)operand;
+                    if (target >= start && target <= branch) return 0;
+                    break;
+                }
+                case 1: {
+                    if (y & 1){ forget(&regs, 4); forget(&regs, 5); }    /* ADD HL,rr */
+                    else if (y < 6){ set(&regs, y, read(emu, pc + 2)); set(&regs, y + 1, operand); }
+                    break;
+                }
+                case 2: {
+                    if (!(y & 1)) return 0;     /* Stores */
+                    if (!pair(&regs, y < 4 ? y - 1 : 4, &address)) return 0;
+                    reads = true;
+                    if (y > 4){ forget(&regs, 4); forget(&regs, 5); }
+                    break;
+                }
+                case 3: if (y < 6){ forget(&regs, y & 6); forget(&regs, (y & 6) + 1); } break;
+                case 4:
+                case 5: if (y == 6) return 0; forget(&regs, y); break;
+                case 6: if (y == 6) return 0; set(&regs, y, operand); break;
+                case 7: break;
+            }
+        }
+        else if (op == 0xCB){
+            u8 r = operand & 7;
+            bool bit = (operand >> 6) == 1;
+
+            if (r == 6){
+                /* Only BIT n,(HL) leaves memory alone */
+                if (!bit || !pair(&regs, 4, &address)) return 0;
+                reads = true;
+            }
+            else if (!bit) forget(&regs, r);
+        }
+        else if (op == 0xF0){ address = 0xFF00 | operand; reads = true; }
+        else if (op == 0xF2){
+            if (!regs.known[1]) return 0;
+            address = 0xFF00 | regs.value[1];
+            reads = true;
+        }
+        else if (op == 0xFA){ address = operand | (read(emu, pc + 2) << 8); reads = true; }
+        else if (z != 6) return 0;      /* Anything else but ALU A,n */
+
+        if (reads && !stable_read(emu, address, from, change)) return 0;
+
+        pc += instruction_length(op);
+        if (pc > branch) return 0;
+    }
+
+    return count + 1;
+}
+
+void idle_branch(Emulator* emu, u16 branch, uint64_t max_instructions){
+    /* Called right after a backward branch at branch was taken, so emu is at the start of the
+     * loop. The first time round only remembers the registers, from the second on the
+     * loop is looked at once registers match. */
+    IdleLoop* idle = &emu->idle;
+    if (!idle->enabled) return;
+
+    if (!idle->watching || idle->branch != branch){
+        idle->watching = true;
+        idle->rejected = false;
+        idle->branch = branch;
+        remember(idle, emu);
+        return;
+    }
+
+    if (idle->rejected || !same_registers(idle, emu)){
+        remember(idle, emu);
+        return;
+    }
+
+    uint64_t change = UINT64_MAX;
+    uint64_t count = loop_body(emu, emu->PC.entireByte + 1, branch, idle->cycles, &change);
+    uint64_t period = emu->cycles - idle->cycles;
+
+    if (count == 0){
+        idle->rejected = true;
+        return;
+    }
+
+    /* Anything else than one pass through the body since last time (a forward branch taken
+     * inside it) and it is left for next time */
+    if (count != emu->instructions - idle->instructions || period == 0){
+        remember(idle, emu);
+        return;
+    }
+
+    /* Every skipped iteration has to end before the block does and before anything it
+     * reads could have changed since the last one started */
+    uint64_t limit = emu->block_end;
+    if (change <= limit) limit = change - 1;
+
+    uint64_t iterations = limit > emu->cycles ? (limit - emu->cycles) / period : 0;
+    uint64_t budget = (max_instructions - emu->instructions) / count;
+    if (budget < iterations) iterations = budget;
+
+    if (iterations > 0){
+        emu->cycles += iterations * period;
+        emu->instructions += iterations * count;
+
+        idle->skips ++;
+        idle->skipped_cycles += iterations * period;
+        idle->skipped_instructions += iterations * count;
+    }
+
+    remember(idle, emu);
+}
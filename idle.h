@@ -0,0 +1,31 @@
+#ifndef gbc_idle
+#define gbc_idle
+
+#include "emulator.h"
+#include "trace.h"
+
+/* Idle loop detection. Games wait for LY, STAT, a timer or a flag set by an interrupt
+ * handler in short loops that only read: LD A,(HL) / CP B / JR NZ and the like. When such a
+ * loop comes back to its start with every register unchanged, each further iteration does
+ * exactly the same until something it reads changes, which is either an event (the end of
+ * the block) or the next step of a register that follows the clock. Whole iterations up to
+ * that point are skipped by adding their cycles and instructions to the counters, so the
+ * state afterwards is the one stepping would have reached.
+ *
+ * A loop qualifies when its body is straight-line code of at most IDLE_MAX_BODY
+ * instructions, none of which writes memory, touches the stack, changes IME or jumps
+ * anywhere but out of the loop, and every address it reads is known from the registers. */
+
+#define IDLE_MAX_BODY 16
+
+void idle_branch(Emulator* emu, u16 branch, uint64_t max_instructions);
+
+/* The hook used by the interpreter core after a taken branch at from. The trace and profile
+ * builds have to see every instruction and leave it out. */
+#if TRACE_LEVEL == TRACE_LEVEL_OFF && !defined(PROFILE)
+#define IDLE_BRANCH(emu, from, max_instructions) if (emu->PC.entireByte < (from)) idle_branch(emu, from, max_instructions);
+#else
+#define IDLE_BRANCH(emu, from, max_instructions) (void)(from)
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include "io.h"
+#include "cpu.h"
+#include "ppu.h"
+
+/* Peripherals are never polled. Anything that happens at a known cycle is an event on the
+ * scheduler, and the registers whose value just follows the clock (DIV, TIMA, LY, STAT mode)
+ * are worked out from the cycle counter when they are read. */
+
+void schedule(Emulator* emu, u8 type, uint64_t when){
+    /* Schedules (or moves) an event and makes sure a block that is already running stops in
+     * time for it. */
+    schedule_event(&emu->scheduler, type, when);
+    if (when < emu->block_end) emu->block_end = when;
+}
+
+static const uint64_t timer_periods[4] = { 1024, 16, 64, 256 };
+
+#define LCD_ON(emu) (emu->IO[R_LCDC] & 0x80)
+#define TIMER_ON(emu) (emu->IO[R_TAC] & 0x04)
+#define TIMER_PERIOD(emu) timer_periods[emu->IO[R_TAC] & 3]
+
+/* Timer:
+ * TIMA counts falling edges of one bit of the internal divider, which happen every period
+ * cycles counted from the last DIV reset. While it runs, only the cycle of the next overflow
+ * is stored and TIMA is derived from how many edges are left until then. */
+
+static uint64_t timer_edges(Emulator* emu, uint64_t cycle){
+    return (cycle - emu->div_base) / TIMER_PERIOD(emu);
+}
+
+static u8 timer_read(Emulator* emu){
+    if (!TIMER_ON(emu)) return emu->IO[R_TIMA];
+
+    return 256 - (timer_edges(emu, emu->tima_overflow) - timer_edges(emu, emu->cycles));
+}
+
+static void timer_start(Emulator* emu, uint64_t from, u8 value){
+    /* Counts up from value starting at cycle from, overflowing (256 - value) edges later. */
+    emu->tima_overflow = emu->div_base + (timer_edges(emu, from) + 256 - value) * TIMER_PERIOD(emu);
+    schedule(emu, EVENT_TIMER, emu->tima_overflow);
+}
+
+static void timer_reconfigure(Emulator* emu, u8 reg, u8 byte){
+    /* Freezes TIMA at its current value, applies the write, then lets it run again. */
+    u8 value = timer_read(emu);
+    cancel_event(&emu->scheduler, EVENT_TIMER);
+
+    if (reg == R_DIV) emu->div_base = emu->cycles;
+    else if (reg == R_TIMA) value = byte;
+    else emu->IO[reg] = byte;
+
+    emu->IO[R_TIMA] = value;
+    if (TIMER_ON(emu)) timer_start(emu, emu->cycles, value);
+}
+
+/* LCD timing:
+ * A frame is 154 lines of 456 cycles starting at lcd_base. Visible lines go through mode 2
+ * (OAM scan, 80 cycles), mode 3 (drawing, 172 cycles) and mode 0 (HBlank), lines 144-153 are
+ * mode 1 (VBlank). Only the points that raise an interrupt are ever scheduled. */
+
+static uint64_t lcd_position(Emulator* emu, uint64_t cycle){
+    return (cycle - emu->lcd_base) % CYCLES_PER_FRAME;
+}
+
+static u8 lcd_mode(uint64_t position){
+    uint64_t dot = position % LINE_CYCLES;
+
+    if (position >= VISIBLE_LINES * LINE_CYCLES) return 1;
+    if (dot < MODE2_CYCLES) return 2;
+    if (dot < MODE2_CYCLES + MODE3_CYCLES) return 3;
+    return 0;
+}
+
+static uint64_t until_position(uint64_t position, uint64_t target){
+    /* Cycles from a frame position to the next time the frame is at target (never 0). */
+    return target > position ? target - position : target + CYCLES_PER_FRAME - position;
+}
+
+static uint64_t until_visible_dot(uint64_t position, uint64_t dot){
+    /* Cycles until a visible line is next at the given dot. */
+    uint64_t line = position / LINE_CYCLES;
+
+    if (line < VISIBLE_LINES && line * LINE_CYCLES + dot > position) return line * LINE_CYCLES + dot - position;
+    if (line + 1 < VISIBLE_LINES) return (line + 1) * LINE_CYCLES + dot - position;
+
+    return until_position(position, dot);
+}
+
+static void schedule_stat(Emulator* emu, uint64_t from){
+    /* Finds the next point after from where an enabled STAT source fires. */
+    cancel_event(&emu->scheduler, EVENT_STAT);
+    if (!LCD_ON(emu)) return;
+
+    u8 stat = emu->IO[R_STAT];
+    uint64_t position = lcd_position(emu, from);
+    uint64_t wait = UINT64_MAX;
+    uint64_t until;
+
+    if (stat & 0x08){   /* Mode 0 */
+        until = until_visible_dot(position, MODE2_CYCLES + MODE3_CYCLES);
+        if (until < wait) wait = until;
+    }
+    if (stat & 0x10){   /* Mode 1 */
+        until = until_position(position, VISIBLE_LINES * LINE_CYCLES);
+        if (until < wait) wait = until;
+    }
+    if (stat & 0x20){   /* Mode 2 */
+        until = until_visible_dot(position, 0);
+        if (until < wait) wait = until;
+    }
+    if ((stat & 0x40) && emu->IO[R_LYC] < CYCLES_PER_FRAME / LINE_CYCLES){   /* LY = LYC */
+        until = until_position(position, emu->IO[R_LYC] * LINE_CYCLES);
+        if (until < wait) wait = until;
+    }
+
+    if (wait != UINT64_MAX) schedule(emu, EVENT_STAT, from + wait);
+}
+
+static void lcd_switch(Emulator* emu, bool on){
+    if (on){
+        emu->lcd_base = emu->cycles;
+        ppu_reset(emu);
+        schedule(emu, EVENT_VBLANK, emu->cycles + VISIBLE_LINES * LINE_CYCLES);
+        schedule_stat(emu, emu->cycles);
+    } else {
+        cancel_event(&emu->scheduler, EVENT_VBLANK);
+        cancel_event(&emu->scheduler, EVENT_STAT);
+    }
+}
+
+void init_io(Emulator* emu){
+    /* Registers as the boot ROM leaves them. */
+    scheduler_init(&emu->scheduler);
+
+    emu->IO[R_TAC] = 0xF8;
+    emu->IO[R_IF] = 0xE1;
+    emu->IO[R_LCDC] = 0x91;
+    emu->IO[R_STAT] = 0x80;
+    emu->IO[R_BGP] = 0xFC;
+    emu->IO[R_NR50] = 0x77;
+    emu->IO[R_NR51] = 0xF3;
+    emu->IO[R_NR52] = 0xF1;
+
+    lcd_switch(emu, true);
+}
+
+void request_interrupt(Emulator* emu, u8 bit){
+    emu->IO[R_IF] |= bit;
+    schedule(emu, EVENT_INTERRUPT, emu->cycles);
+}
+
+u8 read_io(Emulator* emu, u8 reg){
+    switch (reg){
+        case R_DIV: return (emu->cycles - emu->div_base) >> 8;
+        case R_TIMA: return timer_read(emu);
+        case R_LY: return LCD_ON(emu) ? lcd_position(emu, emu->cycles) / LINE_CYCLES : 0;
+        case R_STAT: {
+            if (!LCD_ON(emu)) return 0x80 | (emu->IO[R_STAT] & 0x78);
+
+            uint64_t position = lcd_position(emu, emu->cycles);
+            bool coincidence = position / LINE_CYCLES == emu->IO[R_LYC];
+
+            return 0x80 | (emu->IO[R_STAT] & 0x78) | (coincidence << 2) | lcd_mode(position);
+        }
+        default: return reg >= R_NR10 && reg < R_WAVE + 0x10 ? apu_read(emu, reg) : emu->IO[reg];
+    }
+}
+
+uint64_t io_next_change(Emulator* emu, u8 reg, uint64_t from){
+    /* First cycle after from at which read_io may return something else for reg, as long as
+     * nothing is written in between. Only the registers that follow the clock move on their
+     * own, the rest change through writes and events. */
+    switch (reg){
+        case R_DIV: return from + 256 - (from - emu->div_base) % 256;
+        case R_TIMA: {
+            if (!TIMER_ON(emu)) return UINT64_MAX;
+
+            uint64_t period = TIMER_PERIOD(emu);
+            return from + period - (from - emu->div_base) % period;
+        }
+        case R_LY:
+        case R_STAT: {
+            if (!LCD_ON(emu)) return UINT64_MAX;
+
+            uint64_t position = lcd_position(emu, from);
+            uint64_t dot = position % LINE_CYCLES;
+            uint64_t next = LINE_CYCLES;
+
+            if (reg == R_STAT && position < VISIBLE_LINES * LINE_CYCLES){
+                if (dot < MODE2_CYCLES) next = MODE2_CYCLES;
+                else if (dot < MODE2_CYCLES + MODE3_CYCLES) next = MODE2_CYCLES + MODE3_CYCLES;
+            }
+
+            return from + next - dot;
+        }
+        case R_NR52: return apu_next_change(emu, from);                 /* Lengths run out on their own */
+        default: return UINT64_MAX;
+    }
+}
+
+void write_io(Emulator* emu, u8 reg, u8 byte){
+    /* Lines already being drawn use the old value */
+    if (reg == R_LCDC || reg == R_SCY || reg == R_SCX || (reg >= R_DMA && reg <= R_WX)) ppu_catch_up(emu);
+
+    if (reg >= R_NR10 && reg < R_WAVE + 0x10){
+        apu_write(emu, reg, byte);
+        return;
+    }
+
+    switch (reg){
+        case R_SC: {
+            emu->IO[R_SC] = byte;
+
+            /* Transfer with the internal clock. Nothing is on the other end of the link cable,
+               so 0xff is shifted in. */
+            if ((byte & 0x81) == 0x81){
+                emu->serial_out = emu->IO[R_SB];
+                schedule(emu, EVENT_SERIAL, emu->cycles + SERIAL_TRANSFER_CYCLES);
+            }
+            break;
+        }
+        case R_DIV:
+        case R_TIMA: timer_reconfigure(emu, reg, byte); break;
+        case R_TAC: timer_reconfigure(emu, reg, byte | 0xF8); break;
+        case R_IF: {
+            emu->IO[R_IF] = byte | 0xE0;
+            schedule(emu, EVENT_INTERRUPT, emu->cycles);
+            break;
+        }
+        case R_LCDC: {
+            bool was_on = LCD_ON(emu);
+            emu->IO[R_LCDC] = byte;
+            if (was_on != (bool)LCD_ON(emu)) lcd_switch(emu, !was_on);
+            break;
+        }
+        case R_STAT: {
+            /* Only the interrupt enables are writable */
+            emu->IO[R_STAT] = 0x80 | (byte & 0x78);
+            schedule_stat(emu, emu->cycles);
+            break;
+        }
+        case R_LYC: {
+            emu->IO[R_LYC] = byte;
+            schedule_stat(emu, emu->cycles);
+            break;
+        }
+        case R_LY: break;   /* Read only */
+        case R_DMA: {
+            /* OAM DMA, done at once: the 640 cycles the CPU would spend in HRAM meanwhile are
+               not modelled */
+            emu->IO[R_DMA] = byte;
+            for (int i = 0; i < 0xA0; i ++) ppu_write_oam(emu, i, read(emu, (byte << 8) | i));
+            break;
+        }
+        default: emu->IO[reg] = byte; break;
+    }
+}
+
+void handle_event(Emulator* emu, u8 type){
+    /* The event is already off the scheduler, when[type] still holds the cycle it was due at,
+       which is what rescheduling counts from so nothing drifts. */
+    uint64_t due = emu->scheduler.when[type];
+
+    switch (type){
+        case EVENT_INTERRUPT: break;   /* Nothing to do, interrupts are checked after every event */
+        case EVENT_TIMER: {
+            emu->IO[R_TIMA] = emu->IO[R_TMA];
+            timer_start(emu, due, emu->IO[R_TMA]);
+            request_interrupt(emu, INT_TIMER);
+            break;
+        }
+        case EVENT_SERIAL: {
+            if (emu->serial_hook != NULL) emu->serial_hook(emu, emu->serial_out);
+            else printf("%c", emu->serial_out);
+            emu->IO[R_SB] = 0xFF;
+            emu->IO[R_SC] &= 0x7F;
+            request_interrupt(emu, INT_SERIAL);
+            break;
+        }
+        case EVENT_VBLANK: {
+            ppu_catch_up(emu);
+            apu_flush(emu);
+            schedule(emu, EVENT_VBLANK, due + CYCLES_PER_FRAME);
+            request_interrupt(emu, INT_VBLANK);
+            break;
+        }
+        case EVENT_STAT: {
+            schedule_stat(emu, due);
+            request_interrupt(emu, INT_STAT);
+            break;
+        }
+    }
+}
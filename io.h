@@ -0,0 +1,32 @@
+#ifndef gbc_io
+#define gbc_io
+
+#include "emulator.h"
+
+/* IF / IE bits */
+typedef enum {
+    INT_VBLANK = 0x01,
+    INT_STAT = 0x02,
+    INT_TIMER = 0x04,
+    INT_SERIAL = 0x08,
+    INT_JOYPAD = 0x10
+} interrupt_bit;
+
+#define SERIAL_TRANSFER_CYCLES 4096   /* 8 bits at 8192 Hz */
+
+#define LINE_CYCLES 456
+#define VISIBLE_LINES 144
+#define MODE2_CYCLES 80
+#define MODE3_CYCLES 172
+
+void init_io(Emulator* emu);
+
+u8 read_io(Emulator* emu, u8 reg);
+uint64_t io_next_change(Emulator* emu, u8 reg, uint64_t from);
+void write_io(Emulator* emu, u8 reg, u8 byte);
+
+void schedule(Emulator* emu, u8 type, uint64_t when);
+void handle_event(Emulator* emu, u8 type);
+void request_interrupt(Emulator* emu, u8 bit);
+
+#endif
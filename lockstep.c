@@ -0,0 +1,216 @@
+#include "lockstep.h"
+#include "cpu.h"
+#include "debug.h"
+
+#define UNKNOWN_OPCODE 0xD3     /* Disassembles as ???? */
+
+#define LINE_LENGTH 256
+
+bool reference_open(Reference* reference, const char* path){
+    /* Binary traces are told apart by their header, anything else is read as text. */
+    char magic[4];
+    memset(reference, 0, sizeof(Reference));
+
+    reference->file = fopen(path, "rb");
+    if (reference->file == NULL) return false;
+
+    if (fread(magic, 4, 1, reference->file) == 1 && memcmp(magic, TRACE_MAGIC, 4) == 0) {
+        reference_close(reference);
+        if (!trace_reader_open(&reference->reader, path)) return false;
+
+        reference->binary = true;
+        reference->level = reference->reader.header.level;
+        reference->first = reference->reader.header.first;
+        return true;
+    }
+
+    rewind(reference->file);
+    reference->level = TRACE_LEVEL_PC;
+
+    return true;
+}
+
+void reference_close(Reference* reference){
+    if (reference->file != NULL) fclose(reference->file);
+    if (reference->binary) trace_reader_close(&reference->reader);
+    reference->file = NULL;
+}
+
+static bool next_text(Reference* reference, TraceRecord* record){
+    /* A record is a register line followed by its PC line, or a PC line alone (PC tier
+     * dumps). The tags are searched for rather than expected at the start of the line,
+     * since serial output is printed without a newline of its own. */
+    char line[LINE_LENGTH];
+    bool registers = false;
+
+    while (fgets(line, sizeof(line), reference->file) != NULL) {
+        char* at;
+        unsigned a, b, c, d, e, h, l, sp, pc, z, n, hc, cy;
+
+        if ((at = strstr(line, "[A")) != NULL &&
+            sscanf(at, "[A%x|B%x|C%x|D%x|E%x|H%x|L%x|SP%x]", &a, &b, &c, &d, &e, &h, &l, &sp) == 8) {
+            record->af = a << 8;
+            record->bc = b << 8 | c;
+            record->de = d << 8 | e;
+            record->hl = h << 8 | l;
+            record->sp = sp;
+            registers = true;
+            continue;
+        }
+
+        if ((at = strstr(line, "[0x")) == NULL || sscanf(at, "[0x%x]", &pc) != 1) continue;
+
+        record->pc = pc;
+        memset(record->opcode, 0, sizeof(record->opcode));
+        record->opcode[0] = UNKNOWN_OPCODE;
+
+        if (registers && sscanf(at, "[0x%*x][Z%u N%u H%u C%u]", &z, &n, &hc, &cy) == 4) {
+            record->af |= z << 7 | n << 6 | hc << 5 | cy << 4;
+
+            /* The disassembly follows the flags */
+            char* text = strchr(strchr(at, ']') + 1, ']') + 1;
+            while (*text == ' ') text ++;
+            assemble(text, record->opcode);
+        }
+
+        reference->level = registers ? TRACE_LEVEL_REGISTERS : TRACE_LEVEL_PC;
+        return true;
+    }
+
+    return false;
+}
+
+bool reference_next(Reference* reference, TraceRecord* record){
+    /* Reads the next record. Returns false at the end of the reference. */
+    return reference->binary ? trace_reader_next(&reference->reader, record) : next_text(reference, record);
+}
+
+static int differences(const TraceRecord* expected, const TraceRecord* actual, uint32_t level, bool flags, char* out){
+    /* Writes the names of the registers that differ to out, returns how many there are. */
+    int count = 0;
+    out[0] = '\0';
+
+#define DIFFERS(name, mask, field) \
+    if (((expected->field ^ actual->field) & (mask)) != 0) count ++, strcat(out, " " name);
+
+    DIFFERS("PC", 0xffff, pc);
+    if (level == TRACE_LEVEL_REGISTERS) {
+        DIFFERS("A", 0xff00, af);
+        if (flags) DIFFERS("F", 0x00f0, af);
+        DIFFERS("B", 0xff00, bc);
+        DIFFERS("C", 0x00ff, bc);
+        DIFFERS("D", 0xff00, de);
+        DIFFERS("E", 0x00ff, de);
+        DIFFERS("H", 0xff00, hl);
+        DIFFERS("L", 0x00ff, hl);
+        DIFFERS("SP", 0xffff, sp);
+    }
+
+#undef DIFFERS
+
+    return count;
+}
+
+static void print_expected(TraceRecord* record, uint32_t level){
+    printf("(reference)\n");
+    trace_print_record(record, level);
+}
+
+static TraceRecord* recorded(Trace* trace, uint64_t index){
+    return &trace->records[index & (trace->capacity - 1)];
+}
+
+static void report(Cartridge* cart, Emulator* emu, Trace* trace, Reference* reference, size_t context,
+    bool flags, uint64_t base, uint64_t at, TraceRecord* expected, uint64_t max_cycles){
+    /* The last context instructions that matched, the divergence, then up to context more from
+     * both sides. The ring still holds everything before the divergence (see lockstep_run). */
+    char names[64];
+    uint32_t level = reference->level < trace->level ? reference->level : trace->level;
+    uint64_t from = at - base > context ? at - context : base;
+
+    printf("Diverged at instruction %llu.\n", (unsigned long long)(reference->first + at - base));
+
+    for (uint64_t i = from; i < at; i ++) {
+        printf("-- %llu --\n(emulator)\n", (unsigned long long)(reference->first + i - base));
+        trace_print_record(recorded(trace, i), trace->level);
+    }
+
+    uint64_t end = at + 1 + context;
+    if (trace->total < end) Start(cart, emu, max_cycles, emu->instructions + (end - trace->total));
+
+    for (uint64_t i = at; i < end; i ++) {
+        TraceRecord next;
+        bool has_reference = i == at || reference_next(reference, &next);
+        bool has_emulator = i < trace->total;
+        if (i == at) next = *expected;
+
+        if (!has_reference && !has_emulator) break;
+
+        printf("-- %llu%s --\n", (unsigned long long)(reference->first + i - base), i == at ? ", first difference" : "");
+        if (has_reference) print_expected(&next, reference->level);
+        if (has_emulator) {
+            printf("(emulator)\n");
+            trace_print_record(recorded(trace, i), trace->level);
+        }
+
+        if (has_reference && has_emulator && differences(&next, recorded(trace, i), level, flags, names) > 0)
+            printf("(differs)%s\n", names);
+    }
+}
+
+LockstepResult lockstep_run(Cartridge* cart, Emulator* emu, Trace* trace, Reference* reference,
+    size_t context, bool flags, uint64_t max_cycles, uint64_t max_instructions){
+    /* Runs in chunks a little smaller than the ring, comparing each chunk as it comes back, so
+     * the context before any divergence is still in the ring when it is found. Only what both
+     * the ring and the reference record is compared. */
+    LockstepResult result = { LOCKSTEP_MATCH, 0, 0 };
+    char names[64];
+
+    while (context > 0 && 2 * context + 1 >= trace->capacity) context --;
+
+    /* A binary reference that starts mid-run (a ring that wrapped) is caught up to first */
+    trace_enable(trace, false);
+    if (reference->first > 0) Start(cart, emu, max_cycles, reference->first < max_instructions ? reference->first : max_instructions);
+
+    if (emu->instructions < reference->first) {
+        result.status = LOCKSTEP_STOPPED;
+        return result;
+    }
+
+    trace_enable(trace, true);
+
+    uint64_t base = trace->total;
+    uint64_t chunk = trace->capacity > 2 * context + 1 ? trace->capacity - 2 * context - 1 : 1;
+
+    while (true) {
+        uint64_t begin = trace->total;
+        uint64_t limit = max_instructions - emu->instructions > chunk ? emu->instructions + chunk : max_instructions;
+
+        Start(cart, emu, max_cycles, limit);
+
+        for (uint64_t i = begin; i < trace->total; i ++) {
+            TraceRecord expected;
+            if (!reference_next(reference, &expected)) return result;
+
+            uint32_t level = reference->level < trace->level ? reference->level : trace->level;
+
+            if (differences(&expected, recorded(trace, i), level, flags, names) > 0) {
+                result.status = LOCKSTEP_DIVERGED;
+                result.index = reference->first + i - base;
+
+                report(cart, emu, trace, reference, context, flags, base, i, &expected, max_cycles);
+                return result;
+            }
+
+            result.compared ++;
+        }
+
+        if (trace->total == begin || !emu->run || emu->cycles >= max_cycles || emu->instructions >= max_instructions) break;
+    }
+
+    /* Out of emulator before out of reference, unless the reference happened to end here too */
+    TraceRecord expected;
+    if (reference_next(reference, &expected)) result.status = LOCKSTEP_STOPPED;
+
+    return result;
+}
@@ -0,0 +1,43 @@
+#ifndef gbc_lockstep
+#define gbc_lockstep
+
+#include "tracefile.h"
+
+/* Lockstep differential testing: runs the emulator with a trace ring attached and checks
+ * every recorded instruction against a reference trace read as a stream, stopping at the
+ * first divergence. Memory use is the ring plus one line, however long the reference is.
+ *
+ * The reference is either a trace file (gbc -t or -w from any ring tier, see tracefile.h)
+ * or a text log in the printRegisters / printInstruction format (gbc-disasm, gbc-tracedump
+ * or debug.py's logs). Lines that are neither, like serial output or warnings, are skipped. */
+
+#define LOCKSTEP_DEFAULT_CONTEXT 3
+
+typedef struct {
+    FILE* file;         /* Text logs */
+    TraceReader reader; /* Binary traces */
+    bool binary;
+    uint32_t level;     /* What the last record holds, TRACE_LEVEL_PC or TRACE_LEVEL_REGISTERS */
+    uint64_t first;     /* Instruction index of the first record */
+} Reference;
+
+typedef enum {
+    LOCKSTEP_MATCH,     /* The reference ran out without a difference */
+    LOCKSTEP_DIVERGED,
+    LOCKSTEP_STOPPED    /* The emulator stopped (or ran out of budget) first */
+} lockstep_status;
+
+typedef struct {
+    lockstep_status status;
+    uint64_t compared;  /* Instructions that matched */
+    uint64_t index;     /* Instruction index of the divergence */
+} LockstepResult;
+
+bool reference_open(Reference* reference, const char* path);
+void reference_close(Reference* reference);
+bool reference_next(Reference* reference, TraceRecord* record);
+
+LockstepResult lockstep_run(Cartridge* cart, Emulator* emu, Trace* trace, Reference* reference,
+    size_t context, bool flags, uint64_t max_cycles, uint64_t max_instructions);
+
+#endif
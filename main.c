@@ -1,36 +1,288 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "cpu.h"
+#include "trace.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "lockstep.h"
+#include "profile.h"
+#include "wav.h"
+
+#define TRACE_RING (TRACE_LEVEL == TRACE_LEVEL_PC || TRACE_LEVEL == TRACE_LEVEL_REGISTERS)
+
+static void write_audio(Emulator* emu, const int16_t* samples, size_t count){
+    wav_write((WavWriter*)emu->user, samples, count);
+}
+
+static void usage(const char* name){
+    printf("Usage: %s [options] <rom>\n", name);
+    printf("  -n <count>  stop after <count> instructions (default %d)\n", DEFAULT_INSTRUCTION_LIMIT);
+    printf("  -c <count>  stop after <count> T-cycles\n");
+    printf("  -f <count>  stop after <count> frames (%d T-cycles each)\n", CYCLES_PER_FRAME);
+    printf("  -s          print instructions executed and host speed to stderr\n");
+    printf("  -r          print the register state when execution stops\n");
+    printf("  -I          do not fast-forward idle loops (for ROMs the detection gets wrong)\n");
+    printf("  -L <file>   start from a save state instead of power on (budgets count from there)\n");
+    printf("  -S <file>   write a save state to <file> when execution stops\n");
+    printf("  -V <file>   write the screen to <file> (PPM) when execution stops\n");
+    printf("  -H          headless: emulate the LCD but draw nothing (-V draws the screen as it is at the end)\n");
+    printf("  -k <count>  turbo: draw one frame in <count>\n");
+    printf("  -A <file>   write the sound to <file> (WAV, 48 kHz stereo), only of frames drawn\n");
+    printf("  -R <MB>     keep a rewind buffer of at most <MB> megabytes, captured every frame\n");
+    printf("  -b <count>  when execution stops, rewind <count> frames (needs -R)\n");
+    printf("  -B <count>  when execution stops, rewind <count> instructions (needs -R)\n");
+#if TRACE_RING
+    printf("  -t <file>   record executed instructions and write them to <file> on exit\n");
+    printf("  -w <file>   write every executed instruction to <file> while running, not just the ring\n");
+    printf("  -T <count>  number of instructions kept by the trace ring (default %d)\n", TRACE_DEFAULT_CAPACITY);
+    printf("  -D <file>   compare every instruction against a reference trace or text log, stop at\n");
+    printf("              the first difference (no instruction limit unless one is given)\n");
+    printf("  -W <count>  instructions of context shown around a difference (default %d)\n", LOCKSTEP_DEFAULT_CONTEXT);
+    printf("  -F          leave the flags out of the comparison\n");
+#endif
+#ifdef PROFILE
+    printf("  -p <file>   write the time spent per call stack to <file>, collapsed for flamegraphs\n");
+    printf("  -P <count>  lines per table of the hot spot report (default %d)\n", PROFILE_REPORT_LINES);
+#endif
+}
 
 int main(int argc, char* argv[]){
 
-    Emulator* emu;
+    Emulator emulator;
+    Emulator* emu = initEmulator(&emulator);
+
+    char* filePath = NULL;
+    uint64_t maxInstructions = DEFAULT_INSTRUCTION_LIMIT;
+    uint64_t maxCycles = UINT64_MAX;
+    bool stats = false;
+    bool registers = false;
+
+    char* loadPath = NULL;
+    char* savePath = NULL;
+    char* screenPath = NULL;
+    bool headless = false;
+    char* audioPath = NULL;
+
+    size_t rewindBudget = 0;
+    size_t rewindFrames = 0;
+    uint64_t rewindBack = 0;
+
+    char* tracePath = NULL;
+    char* streamPath = NULL;
+    size_t traceCapacity = TRACE_DEFAULT_CAPACITY;
+
+    char* referencePath = NULL;
+    size_t context = LOCKSTEP_DEFAULT_CONTEXT;
+    bool compareFlags = true;
+    bool budgetGiven = false;
+    bool diverged = false;
+
+#ifdef PROFILE
+    char* stacksPath = NULL;
+    size_t reportLines = PROFILE_REPORT_LINES;
+#endif
+
+    for (int i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) maxInstructions = strtoull(argv[++ i], NULL, 0), budgetGiven = true;
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) maxCycles = strtoull(argv[++ i], NULL, 0), maxInstructions = UINT64_MAX, budgetGiven = true;
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) maxCycles = strtoull(argv[++ i], NULL, 0) * CYCLES_PER_FRAME, maxInstructions = UINT64_MAX, budgetGiven = true;
+        else if (strcmp(argv[i], "-s") == 0) stats = true;
+        else if (strcmp(argv[i], "-r") == 0) registers = true;
+        else if (strcmp(argv[i], "-I") == 0) emu->idle.enabled = false;
+        else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) loadPath = argv[++ i];
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) savePath = argv[++ i];
+        else if (strcmp(argv[i], "-V") == 0 && i + 1 < argc) screenPath = argv[++ i];
+        else if (strcmp(argv[i], "-H") == 0) headless = true;
+        else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) audioPath = argv[++ i];
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) emulator_set_render(emu, strtoul(argv[++ i], NULL, 0));
+        else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) rewindBudget = strtoull(argv[++ i], NULL, 0) << 20;
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) rewindFrames = strtoul(argv[++ i], NULL, 0);
+        else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) rewindBack = strtoull(argv[++ i], NULL, 0);
+#if TRACE_RING
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) tracePath = argv[++ i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) streamPath = argv[++ i];
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) traceCapacity = strtoul(argv[++ i], NULL, 0);
+        else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) referencePath = argv[++ i];
+        else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) context = strtoul(argv[++ i], NULL, 0);
+        else if (strcmp(argv[i], "-F") == 0) compareFlags = false;
+#endif
+#ifdef PROFILE
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) stacksPath = argv[++ i];
+        else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) reportLines = strtoul(argv[++ i], NULL, 0);
+#endif
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            exit(1);
+        }
+        else filePath = argv[i];
+    }
 
-    initEmulator(emu);
+    if (referencePath != NULL && !budgetGiven) maxInstructions = UINT64_MAX;
+    if (headless) emulator_set_render(emu, 0);
 
-    if (argc > 1) {
-        char* filePath = argv[1];
-        FILE* file = fopen(filePath, "r");
+    if (filePath != NULL) {
+        size_t size;
+        uint8_t* memory = mapRom(filePath, &size);
 
-        if (file == NULL) {
+        if (memory == NULL) {
             printf("Cannot open file.\n");
             exit(10);
         }
 
-        fseek(file, 0, SEEK_END);
-        long size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        
-        uint8_t* memory = (uint8_t*)malloc(size);
-        size_t e = fread(memory, size, 1, file);
-        fclose(file);
-
         Cartridge cart;
         initCartridge(&cart, memory, size);
         //print_cartridge(&cart);
 
-        Start(&cart, emu);
+        if (loadPath != NULL) {
+            state_error error = load_state_file(emu, &cart, loadPath);
+            if (error != STATE_OK) {
+                printf("Cannot load save state (error %d).\n", error);
+                exit(12);
+            }
+
+            if (maxCycles != UINT64_MAX) maxCycles += emu->cycles;
+            if (maxInstructions != UINT64_MAX) maxInstructions += emu->instructions;
+        }
+
+        Reference reference;
+        if (referencePath != NULL && !reference_open(&reference, referencePath)) {
+            printf("Cannot open the reference trace.\n");
+            exit(13);
+        }
+
+        Trace trace;
+        bool ring = tracePath != NULL || streamPath != NULL || referencePath != NULL;
+        if (ring) {
+            if (!trace_init(&trace, traceCapacity, TRACE_LEVEL)) {
+                printf("Cannot allocate the trace buffer.\n");
+                exit(11);
+            }
+
+            trace_enable(&trace, true);
+            emu->trace = &trace;
+        }
+
+#ifdef PROFILE
+        Profile profile;
+        if (!profile_init(&profile)) {
+            printf("Cannot allocate the profiler.\n");
+            exit(11);
+        }
+
+        emu->profile = &profile;
+#endif
+
+        WavWriter wav;
+        if (audioPath != NULL) {
+            if (!wav_open(&wav, audioPath, APU_RATE)) {
+                printf("Cannot write the sound.\n");
+                exit(13);
+            }
+
+            emu->user = &wav;
+            emulator_set_audio(emu, write_audio);
+        }
+
+        Rewind rewind;
+        if (rewindBudget > 0 && !rewind_init(&rewind, rewindBudget)) {
+            printf("Cannot allocate the rewind buffer.\n");
+            exit(11);
+        }
+
+        clock_t started = clock();
+        if (referencePath != NULL) {
+            LockstepResult result = lockstep_run(&cart, emu, &trace, &reference, context, compareFlags, maxCycles, maxInstructions);
+
+            if (result.status == LOCKSTEP_MATCH) printf("%llu instructions match the reference.\n", (unsigned long long)result.compared);
+            else if (result.status == LOCKSTEP_STOPPED) printf("Stopped after %llu matching instructions, the reference goes on.\n", (unsigned long long)result.compared);
+
+            diverged = result.status != LOCKSTEP_MATCH;
+            reference_close(&reference);
+        }
+        else if (streamPath != NULL) {
+            if (!trace_stream(&cart, emu, &trace, streamPath, maxCycles, maxInstructions)) printf("Cannot write trace file.\n");
+        }
+        else if (rewindBudget > 0) {
+            /* Frame by frame, capturing after each one. The first Start only attaches the
+             * cartridge so power on (or the loaded state) is captured too. */
+            Start(&cart, emu, emu->cycles, maxInstructions);
+            rewind_capture(&rewind, emu);
+
+            while (emu->run && emu->cycles < maxCycles && emu->instructions < maxInstructions) {
+                uint64_t frameEnd = (emu->cycles / CYCLES_PER_FRAME + 1) * CYCLES_PER_FRAME;
+                Start(&cart, emu, frameEnd < maxCycles ? frameEnd : maxCycles, maxInstructions);
+                rewind_capture(&rewind, emu);
+            }
+        }
+        else Start(&cart, emu, maxCycles, maxInstructions);
+        double seconds = (double)(clock() - started) / CLOCKS_PER_SEC;
+
+        if (audioPath != NULL) {
+            emulator_set_audio(emu, NULL);
+            if (!wav_close(&wav)) printf("Cannot write the sound.\n");
+        }
+
+#ifdef PROFILE
+        profile_finish(&profile, emu);
+        profile_report(&profile, emu, stdout, reportLines);
+
+        if (stacksPath != NULL && !profile_save_stacks(&profile, stacksPath)) printf("Cannot write the call stacks.\n");
+        profile_free(&profile);
+        emu->profile = NULL;
+#endif
+
+        if (stats) {
+            double emulated = (double)emu->cycles / CPU_CLOCK_HZ;
+
+            fprintf(stderr, "%llu instructions in %.3f s, %.2f MIPS (trace level %d)\n",
+                (unsigned long long)emu->instructions, seconds,
+                seconds > 0 ? emu->instructions / seconds / 1e6 : 0.0, TRACE_LEVEL);
+            fprintf(stderr, "%llu cycles (%.3f s emulated), %.2f emulated MHz, %.1fx realtime\n",
+                (unsigned long long)emu->cycles, emulated,
+                seconds > 0 ? emu->cycles / seconds / 1e6 : 0.0, seconds > 0 ? emulated / seconds : 0.0);
+            fprintf(stderr, "%llu cycles skipped while halted (%.1f%%)\n",
+                (unsigned long long)emu->halted_cycles,
+                emu->cycles > 0 ? 100.0 * emu->halted_cycles / emu->cycles : 0.0);
+            fprintf(stderr, "%llu cycles (%.1f%%) and %llu instructions skipped in %llu idle loops\n",
+                (unsigned long long)emu->idle.skipped_cycles,
+                emu->cycles > 0 ? 100.0 * emu->idle.skipped_cycles / emu->cycles : 0.0,
+                (unsigned long long)emu->idle.skipped_instructions, (unsigned long long)emu->idle.skips);
+            fprintf(stderr, "%llu frames drawn and %llu skipped, %.1f per second\n", (unsigned long long)emu->ppu.frames,
+                (unsigned long long)emu->ppu.frames_skipped,
+                seconds > 0 ? (emu->ppu.frames + emu->ppu.frames_skipped) / seconds : 0.0);
+            fprintf(stderr, "%llu tile rows drawn from the tile cache, %llu decoded first\n",
+                (unsigned long long)emu->ppu.tile_hits, (unsigned long long)emu->ppu.tile_misses);
+            if (audioPath != NULL) fprintf(stderr, "%llu sound samples (%.3f s) from %llu register writes\n",
+                (unsigned long long)emu->apu.produced, (double)emu->apu.produced / APU_RATE,
+                (unsigned long long)emu->apu.writes);
+        }
+
+        if (rewindBudget > 0) {
+            if (rewindFrames > 0) rewind_frames(&rewind, emu, rewindFrames);
+            if (rewindBack > 0 && !rewind_instructions(&rewind, emu, rewindBack))
+                printf("Cannot rewind that far, the buffer starts at instruction %llu.\n",
+                    (unsigned long long)rewind.records[0].instructions);
+
+            if (stats) fprintf(stderr, "rewind buffer: %zu frames in %zu bytes\n", rewind.count, rewind.bytes);
+            rewind_free(&rewind);
+        }
+
+        if (registers) {
+            printRegisters(emu);
+            printInstruction(emu);
+        }
+
+        if (tracePath != NULL && !trace_save(&trace, tracePath)) printf("Cannot write trace file.\n");
+        if (ring) trace_free(&trace);
+
+        if (savePath != NULL && !save_state_file(emu, savePath)) printf("Cannot write save state.\n");
+        if (screenPath != NULL && emu->ppu.render_every != 1) ppu_draw_frame(emu);
+        if (screenPath != NULL && !ppu_save_ppm(emu, screenPath)) printf("Cannot write the screen.\n");
+
+        unmapRom(memory, size);
+        if (diverged) exit(2);
 
     } else {
         printf("No input file has been provided.\n");
@@ -0,0 +1,267 @@
+#include "mbc.h"
+#include "cpu.h"
+
+/* Memory bank controllers. Every bank switch is turned into a handful of page table updates
+ * (map_pages), so reads and writes of ROM and external RAM never do any bank arithmetic:
+ * the page table already points at the selected bank. Only the register writes, RTC access,
+ * MBC2 RAM writes and disabled RAM go through here. */
+
+#define SECONDS_PER_DAY 86400
+#define RTC_DAYS 512
+
+static uint32_t ram_sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
+static u8 kind_of(CARTRIDGE_TYPE type, bool* has_rtc){
+    *has_rtc = type == CT_MBC3_TIMER_BATTERY || type == CT_MBC3_TIMER_RAM_BATTERY2;
+
+    switch (type){
+        case CT_ROM_ONLY: case CT_ROM_RAM1: case CT_ROM_RAM1_BATTERY1: return MBC_NONE;
+        case CT_MBC1: case CT_MBC1_RAM: case CT_MBC1_RAM_BATTERY: return MBC_1;
+        case CT_MBC2: case CT_MBC2_BATTERY: return MBC_2;
+        case CT_MBC3_TIMER_BATTERY: case CT_MBC3_TIMER_RAM_BATTERY2: case CT_MBC3:
+        case CT_MBC3_RAM2: case CT_MBC3_RAM_BATTERY2: return MBC_3;
+        case CT_MBC5: case CT_MBC5_RAM: case CT_MBC5_RAM_BATTERY: case CT_MBC5_RUMBLE:
+        case CT_MBC5_RUMBLE_RAM: case CT_MBC5_RUMBLE_RAM_BATTERY: return MBC_5;
+        default: return 0xff;
+    }
+}
+
+uint32_t mbc_ram_size(Cartridge* cart){
+    /* External RAM in bytes, from the header (MBC2 has its own, whatever the header says) */
+    bool has_rtc;
+
+    if (kind_of(cart->cartridge_type, &has_rtc) == MBC_2) return MBC2_RAM_SIZE;
+    if (cart->ramsize < sizeof(ram_sizes) / sizeof(ram_sizes[0])) return ram_sizes[cart->ramsize];
+
+    return 0;
+}
+
+void init_mbc(Emulator* emu){
+    /* Mapper state for emu->cart at power on. */
+    Mapper* mbc = &emu->mbc;
+    Cartridge* cart = emu->cart;
+
+    memset(mbc, 0, sizeof(Mapper));
+    memset(emu->eram, 0xff, sizeof(emu->eram));
+    memset(emu->dirty + (emu->eram - emu->vram) / 0x100, 1, ERAM_MAX / 0x100);
+
+    mbc->kind = kind_of(cart->cartridge_type, &mbc->has_rtc);
+    if (mbc->kind == 0xff){
+        log_warning(emu, "Unsupported cartridge type, running it as ROM only.");
+        mbc->kind = MBC_NONE;
+    }
+
+    size_t banks = (cart->size + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+    mbc->rom_banks = 2;
+    while (mbc->rom_banks < banks && mbc->rom_banks < 512) mbc->rom_banks *= 2;
+
+    mbc->ram_size = mbc_ram_size(cart);
+
+    /* Plain ROM + RAM carts have no enable register */
+    mbc->ram_enabled = mbc->kind == MBC_NONE;
+    mbc->rom_bank = 1;
+}
+
+static void map_rom_bank(Emulator* emu, u16 start, uint32_t bank){
+    /* Maps a 16 KB ROM bank at start. Banks (or trailing pages) missing from the file are
+     * unmapped and read as 0xff. */
+    Cartridge* cart = emu->cart;
+    size_t offset = (size_t)(bank & (emu->mbc.rom_banks - 1)) * ROM_BANK_SIZE;
+
+    map_pages(emu->read_map, start, start + ROM_BANK_SIZE - 1, NULL);
+    if (offset >= cart->size) return;
+
+    size_t length = cart->size - offset < ROM_BANK_SIZE ? cart->size - offset : ROM_BANK_SIZE;
+    if (length >= 0x100) map_pages(emu->read_map, start, start + (length & ~0xff) - 1, cart->file + offset);
+}
+
+static void map_ram(Emulator* emu){
+    /* External RAM is mapped directly unless it is disabled, missing, or showing an RTC
+     * register. MBC2 RAM is read directly (its 512 bytes are mirrored over the whole
+     * range) but written through mbc_write, which keeps the upper half byte set. */
+    Mapper* mbc = &emu->mbc;
+
+    map_pages(emu->read_map, EXTERNAL_RAM_8KB, EXTERNAL_RAM_8KB_END, NULL);
+    map_pages(emu->write_map, EXTERNAL_RAM_8KB, EXTERNAL_RAM_8KB_END, NULL);
+
+    if (!mbc->ram_enabled || mbc->ram_size == 0) return;
+
+    if (mbc->kind == MBC_2){
+        for (u16 mirror = EXTERNAL_RAM_8KB; mirror <= EXTERNAL_RAM_8KB_END - (MBC2_RAM_SIZE - 1); mirror += MBC2_RAM_SIZE)
+            map_pages(emu->read_map, mirror, mirror + MBC2_RAM_SIZE - 1, emu->eram);
+        return;
+    }
+
+    u8 bank = 0;
+    if (mbc->kind == MBC_1 && mbc->mode) bank = mbc->bank_hi;
+    else if (mbc->kind == MBC_3){
+        if (mbc->ram_bank >= 0x08) return;      /* RTC register */
+        bank = mbc->ram_bank;
+    }
+    else if (mbc->kind == MBC_5) bank = mbc->ram_bank;
+
+    uint32_t size = mbc->ram_size < RAM_BANK_SIZE ? mbc->ram_size : RAM_BANK_SIZE;
+    uint32_t banks = mbc->ram_size / size;
+    u8* base = emu->eram + (bank % banks) * RAM_BANK_SIZE;
+
+    map_pages(emu->read_map, EXTERNAL_RAM_8KB, EXTERNAL_RAM_8KB + size - 1, base);
+    map_pages(emu->write_map, EXTERNAL_RAM_8KB, EXTERNAL_RAM_8KB + size - 1, base);
+}
+
+void map_mbc(Emulator* emu){
+    /* Points the ROM and external RAM pages at the banks the registers select. */
+    Mapper* mbc = &emu->mbc;
+    uint32_t low = 0, high = 1;
+
+    switch (mbc->kind){
+        case MBC_NONE: high = 1; break;
+        case MBC_1: {
+            low = mbc->mode ? mbc->bank_hi << 5 : 0;
+            high = (mbc->bank_hi << 5) | (mbc->rom_bank ? mbc->rom_bank : 1);
+            break;
+        }
+        case MBC_2:
+        case MBC_3: high = mbc->rom_bank ? mbc->rom_bank : 1; break;
+        case MBC_5: high = mbc->rom_bank; break;
+    }
+
+    map_rom_bank(emu, ROM_N0_16KB, low);
+    map_rom_bank(emu, ROM_N1_NN_16KB, high);
+    map_ram(emu);
+}
+
+/* MBC3 clock */
+
+static void rtc_update(Emulator* emu){
+    /* Folds the whole seconds elapsed since rtc_cycle into rtc_seconds. */
+    Mapper* mbc = &emu->mbc;
+
+    if (mbc->rtc_halted) mbc->rtc_cycle = emu->cycles;
+    else {
+        uint64_t seconds = (emu->cycles - mbc->rtc_cycle) / CPU_CLOCK_HZ;
+        mbc->rtc_seconds += seconds;
+        mbc->rtc_cycle += seconds * CPU_CLOCK_HZ;
+    }
+
+    if (mbc->rtc_seconds >= (uint64_t)RTC_DAYS * SECONDS_PER_DAY){
+        mbc->rtc_seconds %= (uint64_t)RTC_DAYS * SECONDS_PER_DAY;
+        mbc->rtc_carry = true;
+    }
+}
+
+static void rtc_registers(Emulator* emu, u8* out){
+    Mapper* mbc = &emu->mbc;
+    uint64_t days = mbc->rtc_seconds / SECONDS_PER_DAY;
+
+    out[0] = mbc->rtc_seconds % 60;
+    out[1] = mbc->rtc_seconds / 60 % 60;
+    out[2] = mbc->rtc_seconds / 3600 % 24;
+    out[3] = days & 0xff;
+    out[4] = ((days >> 8) & 1) | (mbc->rtc_halted ? 0x40 : 0) | (mbc->rtc_carry ? 0x80 : 0);
+}
+
+static void rtc_write(Emulator* emu, u8 reg, u8 byte){
+    Mapper* mbc = &emu->mbc;
+    u8 r[5];
+
+    rtc_update(emu);
+    rtc_registers(emu, r);
+
+    switch (reg){
+        case 0x08: r[0] = byte % 60; mbc->rtc_cycle = emu->cycles; break;  /* Also restarts the second */
+        case 0x09: r[1] = byte % 60; break;
+        case 0x0A: r[2] = byte % 24; break;
+        case 0x0B: r[3] = byte; break;
+        case 0x0C: {
+            r[4] = byte;
+            mbc->rtc_carry = byte & 0x80;
+            mbc->rtc_halted = byte & 0x40;
+            break;
+        }
+    }
+
+    uint64_t days = r[3] | ((r[4] & 1) << 8);
+    mbc->rtc_seconds = ((days * 24 + r[2]) * 60 + r[1]) * 60 + r[0];
+}
+
+/* Bus */
+
+u8 mbc_read(Emulator* emu){
+    /* Only unmapped external RAM gets here: disabled or missing RAM reads as 0xff, the RTC
+     * register the bank selects wherever it is read. */
+    Mapper* mbc = &emu->mbc;
+
+    if (mbc->kind == MBC_3 && mbc->ram_enabled && mbc->ram_bank >= 0x08 && mbc->ram_bank <= 0x0C)
+        return mbc->rtc_latched[mbc->ram_bank - 0x08];
+
+    return 0xff;
+}
+
+static void write_register(Emulator* emu, u16 addr, u8 byte){
+    Mapper* mbc = &emu->mbc;
+    Mapper before = *mbc;
+
+    switch (mbc->kind){
+        case MBC_NONE: return;
+        case MBC_1: {
+            if (addr < 0x2000) mbc->ram_enabled = (byte & 0x0F) == 0x0A;
+            else if (addr < 0x4000) mbc->rom_bank = byte & 0x1F;
+            else if (addr < 0x6000) mbc->bank_hi = byte & 0x03;
+            else mbc->mode = byte & 1;
+            break;
+        }
+        case MBC_2: {
+            /* Bit 8 of the address picks the register, anywhere in 0x0000 ~ 0x3FFF */
+            if (addr >= 0x4000) return;
+            if (addr & 0x100) mbc->rom_bank = byte & 0x0F;
+            else mbc->ram_enabled = (byte & 0x0F) == 0x0A;
+            break;
+        }
+        case MBC_3: {
+            if (addr < 0x2000) mbc->ram_enabled = (byte & 0x0F) == 0x0A;
+            else if (addr < 0x4000) mbc->rom_bank = byte & 0x7F;
+            else if (addr < 0x6000) mbc->ram_bank = byte & 0x0F;
+            else {
+                if (mbc->has_rtc && mbc->rtc_latch == 0 && byte == 1){
+                    rtc_update(emu);
+                    rtc_registers(emu, mbc->rtc_latched);
+                }
+                mbc->rtc_latch = byte;
+                return;     /* Nothing to remap */
+            }
+            break;
+        }
+        case MBC_5: {
+            if (addr < 0x2000) mbc->ram_enabled = (byte & 0x0F) == 0x0A;
+            else if (addr < 0x3000) mbc->rom_bank = (mbc->rom_bank & 0x100) | byte;
+            else if (addr < 0x4000) mbc->rom_bank = (mbc->rom_bank & 0xFF) | ((byte & 1) << 8);
+            else if (addr < 0x6000) mbc->ram_bank = byte & 0x0F;
+            else return;
+            break;
+        }
+    }
+
+    /* Games write the same bank over and over (and some write to ROM by accident), only
+     * an actual change is worth touching the page table for. */
+    if (mbc->ram_enabled != before.ram_enabled || mbc->rom_bank != before.rom_bank || mbc->bank_hi != before.bank_hi
+        || mbc->ram_bank != before.ram_bank || mbc->mode != before.mode) map_mbc(emu);
+}
+
+void mbc_write(Emulator* emu, u16 addr, u8 byte){
+    /* Writes to ROM (bank registers) and to external RAM that is not mapped for writing. */
+    Mapper* mbc = &emu->mbc;
+
+    if (addr <= ROM_N1_NN_16KB_END){
+        write_register(emu, addr, byte);
+        return;
+    }
+
+    if (!mbc->ram_enabled) return;
+
+    if (mbc->kind == MBC_2){
+        emu->eram[addr & (MBC2_RAM_SIZE - 1)] = byte | 0xF0;
+        MARK_DIRTY(emu, emu->eram + (addr & (MBC2_RAM_SIZE - 1)));
+    }
+    else if (mbc->kind == MBC_3 && mbc->has_rtc && mbc->ram_bank >= 0x08 && mbc->ram_bank <= 0x0C)
+        rtc_write(emu, mbc->ram_bank, byte);
+}
@@ -0,0 +1,52 @@
+#ifndef gbc_mbc
+#define gbc_mbc
+
+#include "cartridge.h"
+
+typedef enum {
+    MBC_NONE,       /* ROM only, optionally with RAM */
+    MBC_1,
+    MBC_2,
+    MBC_3,
+    MBC_5
+} mbc_kind;
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+#define ERAM_MAX 0x20000            /* 16 banks of 8 KB, the most MBC5 can address */
+#define MBC2_RAM_SIZE 0x200         /* 512 half bytes, built into the chip */
+
+/* Bank registers as last written by the game. The memory map is derived from them, so
+ * they are all that has to be saved to restore a mapper. */
+typedef struct {
+    u8 kind;
+    bool has_rtc;
+    u16 rom_banks;          /* Banks in the file, rounded up to a power of two */
+    uint32_t ram_size;      /* External RAM in bytes, from the header */
+
+    bool ram_enabled;
+    u16 rom_bank;           /* Low bank register (all 9 bits on MBC5) */
+    u8 bank_hi;             /* MBC1: the 2-bit register at 0x4000 */
+    u8 ram_bank;            /* MBC3 / MBC5: RAM bank, or RTC register 0x08 ~ 0x0C on MBC3 */
+    u8 mode;                /* MBC1 banking mode */
+
+    /* MBC3 clock, counted in emulated time so runs stay deterministic */
+    uint64_t rtc_seconds;   /* Clock value at rtc_cycle */
+    uint64_t rtc_cycle;
+    bool rtc_halted;
+    bool rtc_carry;         /* Day counter overflowed */
+    u8 rtc_latch;           /* Last byte written to 0x6000 ~ 0x7FFF */
+    u8 rtc_latched[5];      /* S, M, H, DL, DH as of the last latch */
+} Mapper;
+
+struct Emulator;
+
+uint32_t mbc_ram_size(Cartridge* cart);
+
+void init_mbc(struct Emulator* emu);
+void map_mbc(struct Emulator* emu);
+
+u8 mbc_read(struct Emulator* emu);
+void mbc_write(struct Emulator* emu, u16 addr, u8 byte);
+
+#endif
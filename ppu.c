@@ -0,0 +1,381 @@
+#include "ppu.h"
+#include "emulator.h"
+#include "cpu.h"
+#include "io.h"
+
+#if defined(__SSE2__) && !defined(PPU_PORTABLE)
+#include <emmintrin.h>
+#define PPU_SSE2
+#endif
+
+#define LCDC_BG_ON 0x01
+#define LCDC_OBJ_ON 0x02
+#define LCDC_OBJ_TALL 0x04
+#define LCDC_BG_MAP 0x08
+#define LCDC_TILES_8000 0x10
+#define LCDC_WINDOW_ON 0x20
+#define LCDC_WINDOW_MAP 0x40
+#define LCDC_LCD_ON 0x80
+
+#define TILES_PER_LINE (SCREEN_WIDTH / 8 + 1)   /* A scrolled line straddles one more tile */
+
+#define MAX_LINE_SPRITES 10
+
+/* Sprite attributes */
+#define OBJ_BEHIND_BG 0x80
+#define OBJ_FLIP_Y 0x40
+#define OBJ_FLIP_X 0x20
+#define OBJ_PALETTE_1 0x10
+
+/* DMG shades, lightest first */
+static const uint32_t shades[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+
+static void build_colors(uint32_t* colors, u8 palette){
+    for (int i = 0; i < 4; i ++) colors[i] = shades[(palette >> (i * 2)) & 3];
+}
+
+static void update_colors(Emulator* emu, bool force){
+    Ppu* ppu = &emu->ppu;
+
+    for (int i = 0; i < 3; i ++){
+        if (!force && ppu->palettes[i] == emu->IO[R_BGP + i]) continue;
+
+        ppu->palettes[i] = emu->IO[R_BGP + i];
+        build_colors(ppu->colors + i * 4, ppu->palettes[i]);
+    }
+}
+
+void ppu_init(Emulator* emu){
+    emu->ppu.render_every = 1;
+    emu->ppu.tile_cache = true;
+    ppu_invalidate_tiles(emu);
+    ppu_index_sprites(emu);
+}
+
+static void bucket(Ppu* ppu, int sprite, u8 y, bool add){
+    /* Adds the sprite to (or takes it off) the lines it covers with y as its Y byte */
+    uint64_t bit = 1ULL << sprite;
+    int top = y - 16;
+    int bottom = top + ppu->sprite_height;
+
+    if (top < 0) top = 0;
+    if (bottom > SCREEN_HEIGHT) bottom = SCREEN_HEIGHT;
+
+    for (int line = top; line < bottom; line ++){
+        if (add) ppu->line_sprites[line] |= bit;
+        else ppu->line_sprites[line] &= ~bit;
+    }
+}
+
+void ppu_index_sprites(Emulator* emu){
+    /* Builds the line buckets from scratch, for the current sprite size */
+    Ppu* ppu = &emu->ppu;
+
+    ppu->sprite_height = emu->IO[R_LCDC] & LCDC_OBJ_TALL ? 16 : 8;
+    memset(ppu->line_sprites, 0, sizeof(ppu->line_sprites));
+
+    for (int i = 0; i < SPRITE_COUNT; i ++) bucket(ppu, i, emu->oam[i * 4], true);
+}
+
+void ppu_write_oam(Emulator* emu, u8 offset, u8 byte){
+    /* Only the Y byte moves a sprite to other lines */
+    if (offset % 4 == 0 && emu->oam[offset] != byte){
+        bucket(&emu->ppu, offset / 4, emu->oam[offset], false);
+        bucket(&emu->ppu, offset / 4, byte, true);
+    }
+
+    emu->oam[offset] = byte;
+}
+
+void ppu_invalidate_tiles(Emulator* emu){
+    memset(emu->ppu.tile_dirty, 1, sizeof(emu->ppu.tile_dirty));
+}
+
+static void start_frame(Ppu* ppu){
+    /* Frames are counted over LCD switches, so frame skipping keeps its rhythm */
+    uint64_t seen = ppu->frames + ppu->frames_skipped;
+
+    ppu->rendering = ppu->render_next || (ppu->render_every != 0 && seen % ppu->render_every == 0);
+    ppu->render_next = false;
+    ppu->line = 0;
+    ppu->window_line = 0;
+}
+
+void ppu_reset(Emulator* emu){
+    /* The LCD just went on: a new frame starts at its first line. */
+    Ppu* ppu = &emu->ppu;
+
+    ppu->frame = 0;
+    start_frame(ppu);
+    update_colors(emu, true);
+}
+
+#ifndef PPU_SSE2
+static u16 spread(u8 value){
+    /* Moves bit k to bit 2k */
+    u16 x = value;
+    x = (x | (x << 4)) & 0x0F0F;
+    x = (x | (x << 2)) & 0x3333;
+    x = (x | (x << 1)) & 0x5555;
+    return x;
+}
+#endif
+
+static inline void decode(u8 low, u8 high, u8* out){
+    /* One row of a tile: the two bit planes to eight colour indexes, leftmost pixel (bit 7)
+     * first. */
+#ifdef PPU_SSE2
+    const __m128i bits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i lo = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(low), bits), bits);
+    __m128i hi = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(high), bits), bits);
+    __m128i index = _mm_or_si128(_mm_and_si128(lo, _mm_set1_epi8(1)), _mm_and_si128(hi, _mm_set1_epi8(2)));
+
+    _mm_storel_epi64((__m128i*)out, index);
+#else
+    u16 word = spread(low) | (spread(high) << 1);
+    for (int k = 0; k < 8; k ++) out[k] = (word >> (14 - 2 * k)) & 3;
+#endif
+}
+
+static u8 reverse(u8 bits){
+    bits = (bits >> 4) | (bits << 4);
+    bits = ((bits >> 2) & 0x33) | ((bits & 0x33) << 2);
+    return ((bits >> 1) & 0x55) | ((bits & 0x55) << 1);
+}
+
+static inline void blend_sprite(u8* objects, u8* behind, const u8* pixels, u8 palette, u8 priority){
+    /* Eight pixels of one sprite: the opaque ones go where no sprite drawn before it (which
+     * has priority) put one */
+#ifdef PPU_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i index = _mm_loadl_epi64((const __m128i*)pixels);
+    __m128i taken = _mm_loadl_epi64((const __m128i*)objects);
+    __m128i empty = _mm_andnot_si128(_mm_cmpeq_epi8(index, zero), _mm_cmpeq_epi8(taken, zero));
+
+    taken = _mm_or_si128(taken, _mm_and_si128(empty, _mm_add_epi8(index, _mm_set1_epi8(palette))));
+    __m128i flags = _mm_or_si128(_mm_loadl_epi64((const __m128i*)behind), _mm_and_si128(empty, _mm_set1_epi8(priority)));
+
+    _mm_storel_epi64((__m128i*)objects, taken);
+    _mm_storel_epi64((__m128i*)behind, flags);
+#else
+    for (int k = 0; k < 8; k ++){
+        if (pixels[k] == 0 || objects[k] != 0) continue;
+
+        objects[k] = pixels[k] + palette;
+        behind[k] = priority;
+    }
+#endif
+}
+
+static void composite(const u8* index, const u8* objects, const u8* behind, u8* out){
+    /* One colour table entry per pixel: the sprite's, unless there is none or it is behind a
+     * background colour other than 0 */
+#ifdef PPU_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int x = 0; x < SCREEN_WIDTH; x += 16){
+        __m128i bg = _mm_loadu_si128((const __m128i*)(index + x));
+        __m128i obj = _mm_loadu_si128((const __m128i*)(objects + x));
+        __m128i hidden = _mm_andnot_si128(_mm_cmpeq_epi8(bg, zero), _mm_loadu_si128((const __m128i*)(behind + x)));
+        __m128i shown = _mm_andnot_si128(_mm_or_si128(hidden, _mm_cmpeq_epi8(obj, zero)), _mm_set1_epi8(-1));
+
+        _mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_and_si128(shown, obj), _mm_andnot_si128(shown, bg)));
+    }
+#else
+    for (int x = 0; x < SCREEN_WIDTH; x ++){
+        bool shown = objects[x] != 0 && !(behind[x] && index[x] != 0);
+        out[x] = shown ? objects[x] : index[x];
+    }
+#endif
+}
+
+static void decode_tile(Emulator* emu, u16 tile){
+    const u8* data = emu->vram + tile * 16;
+
+    for (int y = 0; y < 8; y ++) decode(data[y * 2], data[y * 2 + 1], emu->ppu.tiles[tile][y]);
+    emu->ppu.tile_dirty[tile] = 0;
+}
+
+static void draw_tiles(Emulator* emu, u8* row, u16 map, u8 y, u8 column, bool unsigned_tiles){
+    /* TILES_PER_LINE tiles of row y of a tile map, starting at a tile column (wrapping). */
+    Ppu* ppu = &emu->ppu;
+    const u8* map_row = emu->vram + map + (y >> 3) * 32;
+    u8 fine = y & 7;
+
+    for (int i = 0; i < TILES_PER_LINE; i ++){
+        u8 number = map_row[(column + i) & 31];
+        u16 tile = unsigned_tiles ? number : 256 + (int8_t)number;
+
+        if (!ppu->tile_cache){
+            decode(emu->vram[tile * 16 + fine * 2], emu->vram[tile * 16 + fine * 2 + 1], row + i * 8);
+            continue;
+        }
+
+        if (ppu->tile_dirty[tile]){
+            decode_tile(emu, tile);
+            ppu->tile_misses ++;
+        }
+        else ppu->tile_hits ++;
+
+        memcpy(row + i * 8, ppu->tiles[tile][fine], 8);
+    }
+}
+
+static int line_sprites(Emulator* emu, u8 line, u8* order){
+    /* The sprites shown on a line: its first MAX_LINE_SPRITES in OAM order, then in drawing
+     * priority (lower X first, OAM order among equal X). */
+    uint64_t bits = emu->ppu.line_sprites[line];
+    int count = 0;
+
+    while (bits != 0 && count < MAX_LINE_SPRITES){
+        u8 sprite = __builtin_ctzll(bits);
+        u8 x = emu->oam[sprite * 4 + 1];
+        int at = count ++;
+
+        bits &= bits - 1;
+        for (; at > 0 && emu->oam[order[at - 1] * 4 + 1] > x; at --) order[at] = order[at - 1];
+        order[at] = sprite;
+    }
+
+    return count;
+}
+
+static void draw_sprite(Emulator* emu, u8 line, u8 sprite){
+    /* One row of a sprite into ppu->objects, whose first pixel is at X byte 0 */
+    Ppu* ppu = &emu->ppu;
+    const u8* oam = emu->oam + sprite * 4;
+    u8 attributes = oam[3];
+    int row = line - (oam[0] - 16);
+    u8 tile = ppu->sprite_height == 16 ? oam[2] & 0xFE : oam[2];
+
+    if (oam[1] >= SCREEN_WIDTH + SPRITE_MARGIN) return;     /* Off screen, but still counted */
+    if (attributes & OBJ_FLIP_Y) row = ppu->sprite_height - 1 - row;
+
+    const u8* data = emu->vram + tile * 16 + row * 2;
+    u8 low = data[0], high = data[1];
+    u8 pixels[8];
+
+    if (attributes & OBJ_FLIP_X){
+        low = reverse(low);
+        high = reverse(high);
+    }
+
+    decode(low, high, pixels);
+    blend_sprite(ppu->objects + oam[1], ppu->behind + oam[1], pixels, attributes & OBJ_PALETTE_1 ? 8 : 4,
+        attributes & OBJ_BEHIND_BG ? 0xFF : 0);
+}
+
+void ppu_draw_line(Emulator* emu, u8 line){
+    /* Background and window of one line into ppu->index, sprites into ppu->objects, then the
+     * two through the palettes into the framebuffer. */
+    Ppu* ppu = &emu->ppu;
+    u8 lcdc = emu->IO[R_LCDC];
+    u8* index = ppu->index;
+    u8 row[TILES_PER_LINE * 8];
+
+    if (lcdc & LCDC_BG_ON){
+        u8 scx = emu->IO[R_SCX];
+        bool unsigned_tiles = lcdc & LCDC_TILES_8000;
+
+        draw_tiles(emu, row, lcdc & LCDC_BG_MAP ? 0x1C00 : 0x1800, line + emu->IO[R_SCY], scx >> 3, unsigned_tiles);
+        memcpy(index, row + (scx & 7), SCREEN_WIDTH);
+
+        /* The window starts at WX - 7 and has its own line counter, which only moves on
+         * lines it is shown on */
+        int wx = emu->IO[R_WX] - 7;
+        if ((lcdc & LCDC_WINDOW_ON) && line >= emu->IO[R_WY] && wx < SCREEN_WIDTH){
+            draw_tiles(emu, row, lcdc & LCDC_WINDOW_MAP ? 0x1C00 : 0x1800, ppu->window_line, 0, unsigned_tiles);
+
+            if (wx >= 0) memcpy(index + wx, row, SCREEN_WIDTH - wx);
+            else memcpy(index, row - wx, SCREEN_WIDTH);
+            ppu->window_line ++;
+        }
+    }
+    else memset(index, 0, SCREEN_WIDTH);    /* Background off shows colour 0 */
+
+    if (ppu->sprite_height != (lcdc & LCDC_OBJ_TALL ? 16 : 8)) ppu_index_sprites(emu);
+
+    u8 order[MAX_LINE_SPRITES];
+    int sprites = lcdc & LCDC_OBJ_ON ? line_sprites(emu, line, order) : 0;
+
+    if (sprites > 0){
+        memset(ppu->objects, 0, sizeof(ppu->objects));
+        memset(ppu->behind, 0, sizeof(ppu->behind));
+        for (int i = 0; i < sprites; i ++) draw_sprite(emu, line, order[i]);
+
+        composite(index, ppu->objects + SPRITE_MARGIN, ppu->behind + SPRITE_MARGIN, row);
+        index = row;
+    }
+
+    update_colors(emu, false);
+
+    uint32_t* out = ppu->framebuffer + line * SCREEN_WIDTH;
+    for (int x = 0; x < SCREEN_WIDTH; x ++) out[x] = ppu->colors[index[x]];
+
+    ppu->lines ++;
+}
+
+void ppu_draw_frame(Emulator* emu){
+    /* The whole screen at once from VRAM and the registers as they are now, for a frame that
+     * was not drawn while it went by (headless runs) */
+    Ppu* ppu = &emu->ppu;
+    u8 window_line = ppu->window_line;
+
+    ppu->window_line = 0;
+    for (int line = 0; line < SCREEN_HEIGHT; line ++) ppu_draw_line(emu, line);
+    ppu->window_line = window_line;
+}
+
+static void draw_until(Emulator* emu, uint64_t position){
+    /* Draws the lines of the current frame whose mode 3 starts before position. */
+    Ppu* ppu = &emu->ppu;
+    if (ppu->line == SCREEN_HEIGHT) return;
+
+    if (!ppu->rendering){
+        /* Only the count of lines gone by is kept */
+        if (position >= (SCREEN_HEIGHT - 1) * LINE_CYCLES + MODE2_CYCLES){
+            ppu->line = SCREEN_HEIGHT;
+            ppu->frames_skipped ++;
+        }
+        return;
+    }
+
+    while (ppu->line < SCREEN_HEIGHT && (uint64_t)ppu->line * LINE_CYCLES + MODE2_CYCLES <= position) ppu_draw_line(emu, ppu->line ++);
+    if (ppu->line == SCREEN_HEIGHT) ppu->frames ++;
+}
+
+void ppu_catch_up(Emulator* emu){
+    /* Draws every line whose mode 3 has started by emu->cycles and is not drawn yet. */
+    if (!(emu->IO[R_LCDC] & LCDC_LCD_ON)) return;
+
+    Ppu* ppu = &emu->ppu;
+    uint64_t elapsed = emu->cycles - emu->lcd_base;
+    uint64_t frame = elapsed / CYCLES_PER_FRAME;
+
+    if (frame != ppu->frame){
+        /* VBlank catches up on every frame, so this only finishes the one before (or starts
+         * over after a state was loaded) */
+        if (frame == ppu->frame + 1) draw_until(emu, CYCLES_PER_FRAME);
+
+        ppu->frame = frame;
+        start_frame(ppu);
+    }
+
+    draw_until(emu, elapsed % CYCLES_PER_FRAME);
+}
+
+bool ppu_save_ppm(Emulator* emu, const char* path){
+    /* The framebuffer as a binary PPM image. */
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i ++){
+        uint32_t pixel = emu->ppu.framebuffer[i];
+        u8 rgb[3] = { (pixel >> 16) & 0xff, (pixel >> 8) & 0xff, pixel & 0xff };
+        fwrite(rgb, 3, 1, file);
+    }
+
+    return fclose(file) == 0;
+}
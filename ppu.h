@@ -0,0 +1,85 @@
+#ifndef gbc_ppu
+#define gbc_ppu
+
+#include "common.h"
+
+/* Scanline renderer. The LCD timing itself (LY, STAT, interrupts) lives in io.c and is worked
+ * out from the cycle counter; the renderer only has to produce pixels, so it lags behind and
+ * catches up: every line whose drawing (mode 3) has started by now is drawn with the
+ * registers and VRAM as they are, just before anything that would change its output (a
+ * VRAM write, a write to an LCD register) and at VBlank. Per line, background and window
+ * tiles are decoded from 2bpp eight pixels at a time (SSE2, or a portable bit interleave
+ * with -DPPU_PORTABLE), then mapped to colours through a table built from the palette.
+ *
+ * Decoded tiles are cached: a VRAM write to tile data only marks its tile dirty, and a dirty
+ * tile is decoded again (all eight rows) the next time a line uses it. Anything that replaces
+ * VRAM wholesale (loading a state) has to call ppu_invalidate_tiles.
+ *
+ * Sprites are never searched for per line: every write to a sprite's Y byte (OAM writes and
+ * OAM DMA alike go through ppu_write_oam) moves it between per-line buckets, one bit per
+ * sprite, so a line's first ten sprites in OAM order are its lowest set bits. They are drawn
+ * into a sprite line with the same decoding as the background and composited over it
+ * sixteen pixels at a time. Replacing OAM wholesale needs ppu_index_sprites.
+ *
+ * Whether a frame is drawn at all is decided when it starts: every frame, every Nth
+ * (render_every), none (headless, 0), plus any frame asked for with render_next. LCD timing
+ * does not depend on it, frames left out only keep the framebuffer as it was. */
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+#define TILE_COUNT 384                      /* 0x8000 ~ 0x97FF */
+#define TILE_DATA_SIZE (TILE_COUNT * 16)
+
+#define SPRITE_COUNT 40
+#define SPRITE_MARGIN 8     /* Sprites start up to 8 pixels left of the screen */
+
+struct Emulator;
+
+typedef struct {
+    uint32_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];   /* 0xAARRGGBB, row after row */
+    u8 index[SCREEN_WIDTH];     /* Background colour index (0 ~ 3) of the last line drawn */
+
+    /* Sprite pixels of the last line drawn, from SPRITE_MARGIN pixels left of the screen to as
+     * many right of it: a colour table entry (0 where there is none), and 0xFF in behind where
+     * that pixel only shows over background colour 0 */
+    u8 objects[SPRITE_MARGIN + SCREEN_WIDTH + SPRITE_MARGIN];
+    u8 behind[SPRITE_MARGIN + SCREEN_WIDTH + SPRITE_MARGIN];
+
+    uint32_t render_every;      /* Draw one frame in that many, 0 for none */
+    bool render_next;           /* Draw the next frame that starts whatever render_every says */
+    bool rendering;             /* The current frame is being drawn */
+
+    uint64_t frame;             /* LCD frame being drawn, counted from when the LCD went on */
+    u8 line;                    /* Next line of it to draw */
+    u8 window_line;             /* Window rows drawn so far this frame */
+
+    u8 palettes[3];             /* BGP, OBP0 and OBP1 the colour table was built for */
+    uint32_t colors[12];        /* Background colours, then those of OBP0 and OBP1 */
+
+    bool tile_cache;            /* On by default, off decodes every tile row as it is drawn */
+    u8 tiles[TILE_COUNT][8][8]; /* Colour indexes of every tile, row by row */
+    u8 tile_dirty[TILE_COUNT];  /* Written since it was last decoded */
+    uint64_t tile_hits;         /* Tile rows drawn from the cache */
+    uint64_t tile_misses;       /* Tile rows that had to decode their tile first */
+
+    uint64_t line_sprites[SCREEN_HEIGHT];   /* Bit n set when sprite n covers the line */
+    u8 sprite_height;           /* 8 or 16, what line_sprites was built for */
+
+    uint64_t frames;            /* Frames completed */
+    uint64_t frames_skipped;    /* Frames that went by without being drawn */
+    uint64_t lines;             /* Lines drawn */
+} Ppu;
+
+void ppu_init(struct Emulator* emu);
+void ppu_reset(struct Emulator* emu);
+void ppu_invalidate_tiles(struct Emulator* emu);
+void ppu_index_sprites(struct Emulator* emu);
+void ppu_write_oam(struct Emulator* emu, u8 offset, u8 byte);
+void ppu_catch_up(struct Emulator* emu);
+void ppu_draw_line(struct Emulator* emu, u8 line);
+void ppu_draw_frame(struct Emulator* emu);
+
+bool ppu_save_ppm(struct Emulator* emu, const char* path);
+
+#endif
@@ -0,0 +1,218 @@
+#include "profile.h"
+#include "cpu.h"
+#include "debug.h"
+
+#define ROOT 0
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t count;
+    u16 key;
+} Entry;
+
+bool profile_init(Profile* profile){
+    memset(profile, 0, sizeof(Profile));
+
+    profile->pc_count = (uint64_t*)calloc(0x10000, sizeof(uint64_t));
+    profile->pc_cycles = (uint64_t*)calloc(0x10000, sizeof(uint64_t));
+    profile->nodes = (ProfileNode*)calloc(PROFILE_MAX_NODES, sizeof(ProfileNode));
+    profile->node_count = 1;    /* The root, whatever runs outside any call */
+
+    if (profile->pc_count == NULL || profile->pc_cycles == NULL || profile->nodes == NULL) {
+        profile_free(profile);
+        return false;
+    }
+
+    return true;
+}
+
+void profile_free(Profile* profile){
+    free(profile->pc_count);
+    free(profile->pc_cycles);
+    free(profile->nodes);
+
+    profile->pc_count = NULL;
+    profile->pc_cycles = NULL;
+    profile->nodes = NULL;
+}
+
+static bool settle(Profile* profile, Emulator* emu){
+    /* Books the instruction being timed, returns false if there was none. */
+    if (!profile->pending) return false;
+
+    uint64_t cycles = emu->cycles - profile->started - (emu->halted_cycles - profile->halted);
+
+    profile->pc_count[profile->pc] ++;
+    profile->pc_cycles[profile->pc] += cycles;
+    profile->op_count[profile->opcode] ++;
+    profile->op_cycles[profile->opcode] += cycles;
+
+    if (profile->opcode == 0xCB) {
+        profile->cb_count[profile->cb] ++;
+        profile->cb_cycles[profile->cb] += cycles;
+    }
+
+    profile->nodes[profile->current].cycles += cycles;
+    profile->instructions ++;
+    profile->cycles += cycles;
+    profile->pending = false;
+
+    return true;
+}
+
+static void enter(Profile* profile, u16 sp, u16 address){
+    /* Past PROFILE_MAX_DEPTH calls are not followed; past PROFILE_MAX_NODES they are, but
+     * their cycles stay with the caller. */
+    if (profile->depth == PROFILE_MAX_DEPTH) return;
+
+    uint32_t child = profile->nodes[profile->current].child;
+    while (child != ROOT && profile->nodes[child].address != address) child = profile->nodes[child].sibling;
+
+    if (child == ROOT && profile->node_count < PROFILE_MAX_NODES) {
+        child = profile->node_count ++;
+
+        ProfileNode* node = &profile->nodes[child];
+        node->address = address;
+        node->parent = profile->current;
+        node->sibling = profile->nodes[profile->current].child;
+        profile->nodes[profile->current].child = child;
+    }
+
+    profile->frames[profile->depth].sp = sp;
+    profile->frames[profile->depth].caller = profile->current;
+    profile->depth ++;
+
+    if (child != ROOT) profile->current = child;
+}
+
+static bool is_call(u8 opcode){
+    /* CALL a16, CALL cc,a16 and RST n */
+    return opcode == 0xCD || (opcode & 0xE7) == 0xC4 || (opcode & 0xC7) == 0xC7;
+}
+
+void profile_instruction(Profile* profile, Emulator* emu){
+    /* Called right before each instruction. PC points at the last byte fetched, so the
+     * instruction itself starts one byte later. */
+    u16 pc = emu->PC.entireByte + 1;
+    u16 sp = emu->SP.entireByte;
+
+    bool previous = settle(profile, emu);
+
+    while (profile->depth > 0 && sp >= profile->frames[profile->depth - 1].sp) {
+        profile->current = profile->frames[-- profile->depth].caller;
+    }
+
+    if (previous && is_call(profile->opcode) && sp == (u16)(profile->sp - 2)) enter(profile, profile->sp, pc);
+
+    profile->pending = true;
+    profile->pc = pc;
+    profile->opcode = read(emu, pc);
+    profile->cb = profile->opcode == 0xCB ? read(emu, pc + 1) : 0;
+    profile->sp = sp;
+    profile->started = emu->cycles;
+    profile->halted = emu->halted_cycles;
+}
+
+void profile_interrupt(Profile* profile, Emulator* emu, u16 vector){
+    /* Called once the return address is pushed but before the dispatch cycles are charged,
+     * so they are counted with the handler's first instruction. */
+    settle(profile, emu);
+    enter(profile, emu->SP.entireByte + 2, vector);
+}
+
+void profile_finish(Profile* profile, Emulator* emu){
+    /* Books the last instruction of a run. */
+    settle(profile, emu);
+}
+
+static int by_cycles(const void* a, const void* b){
+    const Entry* x = (const Entry*)a;
+    const Entry* y = (const Entry*)b;
+
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static size_t collect(Entry* entries, const uint64_t* counts, const uint64_t* cycles, size_t size){
+    size_t used = 0;
+
+    for (size_t key = 0; key < size; key ++) {
+        if (counts[key] == 0) continue;
+
+        entries[used].cycles = cycles[key];
+        entries[used].count = counts[key];
+        entries[used].key = key;
+        used ++;
+    }
+
+    qsort(entries, used, sizeof(Entry), by_cycles);
+    return used;
+}
+
+static void opcode_table(Profile* profile, FILE* out, Entry* entries, const uint64_t* counts, const uint64_t* cycles, bool cb, size_t lines){
+    size_t used = collect(entries, counts, cycles, 0x100);
+    char name[DISASM_LENGTH];
+
+    fprintf(out, "\n%s by cycles (%zu seen):\n", cb ? "CB opcodes" : "Opcodes", used);
+    fprintf(out, "  %12s %7s %12s  %s\n", "cycles", "", "count", "opcode");
+
+    for (size_t i = 0; i < used && i < lines; i ++) {
+        opcode_name(entries[i].key, cb, name);
+        fprintf(out, "  %12llu %6.2f%% %12llu  %s%02x  %s\n", (unsigned long long)entries[i].cycles,
+            100.0 * entries[i].cycles / (profile->cycles ? profile->cycles : 1), (unsigned long long)entries[i].count,
+            cb ? "CB " : "", entries[i].key, name);
+    }
+}
+
+void profile_report(Profile* profile, Emulator* emu, FILE* out, size_t lines){
+    /* The hottest addresses (disassembled from memory as it is now), opcodes and CB opcodes,
+     * each sorted by cycles. */
+    Entry* entries = (Entry*)malloc(0x10000 * sizeof(Entry));
+    if (entries == NULL) return;
+
+    size_t used = collect(entries, profile->pc_count, profile->pc_cycles, 0x10000);
+    char text[DISASM_LENGTH];
+
+    fprintf(out, "Profile: %llu instructions, %llu cycles (time halted not included), %u call sites\n",
+        (unsigned long long)profile->instructions, (unsigned long long)profile->cycles, profile->node_count - 1);
+
+    fprintf(out, "\nAddresses by cycles (%zu seen):\n", used);
+    fprintf(out, "  %12s %7s %12s  %s\n", "cycles", "", "count", "address");
+
+    for (size_t i = 0; i < used && i < lines; i ++) {
+        u16 address = entries[i].key;
+        u8 op[3] = { read(emu, address), read(emu, address + 1), read(emu, address + 2) };
+
+        disassemble(op, text);
+        fprintf(out, "  %12llu %6.2f%% %12llu  0x%04x  %s\n", (unsigned long long)entries[i].cycles,
+            100.0 * entries[i].cycles / (profile->cycles ? profile->cycles : 1), (unsigned long long)entries[i].count,
+            address, text);
+    }
+
+    opcode_table(profile, out, entries, profile->op_count, profile->op_cycles, false, lines);
+    opcode_table(profile, out, entries, profile->cb_count, profile->cb_cycles, true, lines);
+
+    free(entries);
+}
+
+bool profile_save_stacks(Profile* profile, const char* path){
+    /* One line per routine that used any cycles itself: "rom;0x0150;0x2a10 <cycles>", the
+     * collapsed format flamegraph.pl and speedscope read. */
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    uint32_t chain[PROFILE_MAX_DEPTH + 1];
+
+    for (uint32_t index = 0; index < profile->node_count; index ++) {
+        if (profile->nodes[index].cycles == 0) continue;
+
+        size_t length = 0;
+        for (uint32_t node = index; node != ROOT; node = profile->nodes[node].parent) chain[length ++] = node;
+
+        fprintf(file, "rom");
+        while (length > 0) fprintf(file, ";0x%04x", profile->nodes[chain[-- length]].address);
+        fprintf(file, " %llu\n", (unsigned long long)profile->nodes[index].cycles);
+    }
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,78 @@
+#ifndef gbc_profile
+#define gbc_profile
+
+#include "emulator.h"
+
+/* Instruction level profiler, compiled in with -DPROFILE (gbc-profile). Every dispatched
+ * instruction is counted per address and per opcode (CB opcodes on their own), along with
+ * the cycles it took: the cycle count between it and the next instruction, minus any time
+ * spent halted. The cycles of an interrupt dispatch go to the handler's first instruction.
+ *
+ * Calls are tracked as a calling context tree: CALL and RST (when taken) and interrupts enter
+ * a child of the current node, and a frame is left as soon as SP climbs back above where it
+ * was at the call, which catches RET, RETI and code that pops its return address alike.
+ * Each node keeps its own cycles, written out as collapsed stacks for flamegraph tools. */
+
+#define PROFILE_MAX_NODES (1 << 16)
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_REPORT_LINES 25
+
+typedef struct {
+    u16 address;        /* Entry point of the routine */
+    uint32_t parent;
+    uint32_t child;     /* First child, 0 for none (node 0 is the root) */
+    uint32_t sibling;
+    uint64_t cycles;    /* Spent in this routine itself */
+} ProfileNode;
+
+typedef struct {
+    u16 sp;             /* SP before the call */
+    uint32_t caller;    /* Node to go back to */
+} ProfileFrame;
+
+struct Profile {
+    uint64_t* pc_count;     /* 0x10000 entries each */
+    uint64_t* pc_cycles;
+    uint64_t op_count[0x100];
+    uint64_t op_cycles[0x100];
+    uint64_t cb_count[0x100];
+    uint64_t cb_cycles[0x100];
+    uint64_t instructions;
+    uint64_t cycles;
+
+    /* The instruction being timed */
+    bool pending;
+    u16 pc;
+    u8 opcode;
+    u8 cb;
+    u16 sp;
+    uint64_t started;
+    uint64_t halted;
+
+    ProfileNode* nodes;
+    uint32_t node_count;
+    uint32_t current;
+    ProfileFrame frames[PROFILE_MAX_DEPTH];
+    uint32_t depth;
+};
+
+bool profile_init(Profile* profile);
+void profile_free(Profile* profile);
+
+void profile_instruction(Profile* profile, Emulator* emu);
+void profile_interrupt(Profile* profile, Emulator* emu, u16 vector);
+void profile_finish(Profile* profile, Emulator* emu);
+
+void profile_report(Profile* profile, Emulator* emu, FILE* out, size_t lines);
+bool profile_save_stacks(Profile* profile, const char* path);
+
+/* The hooks used by the interpreter core. */
+#ifdef PROFILE
+#define PROFILE_INSTRUCTION(emu) if (emu->profile != NULL) profile_instruction(emu->profile, emu);
+#define PROFILE_INTERRUPT(emu, vector) if (emu->profile != NULL) profile_interrupt(emu->profile, emu, vector);
+#else
+#define PROFILE_INSTRUCTION(emu)
+#define PROFILE_INTERRUPT(emu, vector)
+#endif
+
+#endif
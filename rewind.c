@@ -0,0 +1,290 @@
+#include "rewind.h"
+#include "savestate.h"
+#include "cpu.h"
+
+#define PAGE_SIZE 0x100
+#define PACKED_MAX(n) ((n) + (n) / 128 + 1)    /* PackBits worst case */
+
+/* PackBits: a header byte h < 128 is followed by h + 1 literal bytes, h >= 128 by one
+ * byte repeated 257 - h times. */
+
+static size_t pack(const u8* in, size_t length, u8* out){
+    size_t written = 0, i = 0;
+
+    while (i < length){
+        size_t run = 1;
+        while (i + run < length && run < 128 && in[i + run] == in[i]) run ++;
+
+        if (run >= 2){
+            out[written ++] = 257 - run;
+            out[written ++] = in[i];
+            i += run;
+            continue;
+        }
+
+        /* Literals up to the next run of 3 (a run of 2 inside literals is not worth it) */
+        size_t start = i;
+        while (i < length && i - start < 128){
+            if (i + 2 < length && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+            i ++;
+        }
+
+        out[written ++] = i - start - 1;
+        memcpy(out + written, in + start, i - start);
+        written += i - start;
+    }
+
+    return written;
+}
+
+static size_t unpack(const u8* in, u8* out, size_t length){
+    /* Returns the packed bytes consumed to produce length bytes. */
+    size_t read = 0, i = 0;
+
+    while (i < length){
+        u8 header = in[read ++];
+
+        if (header < 128){
+            memcpy(out + i, in + read, header + 1);
+            read += header + 1;
+            i += header + 1;
+        } else {
+            memset(out + i, in[read ++], 257 - header);
+            i += 257 - header;
+        }
+    }
+
+    return read;
+}
+
+static size_t used_pages(Emulator* emu){
+    /* VRAM, WRAM and as much external RAM as the cartridge has */
+    return (BULK_SIZE - ERAM_MAX + emu->mbc.ram_size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+bool rewind_init(Rewind* rewind, size_t budget){
+    memset(rewind, 0, sizeof(Rewind));
+    rewind->budget = budget;
+
+    /* scratch and core wait for the first capture, they depend on the core state's size */
+    rewind->shadow = (u8*)malloc(BULK_SIZE);
+
+    return rewind->shadow != NULL;
+}
+
+static bool reserve(Rewind* rewind, Emulator* emu){
+    /* Sizes core for emu's core state, and scratch for that plus every page, packed as badly
+     * as possible. */
+    size_t core_size = core_state_size(emu);
+    if (core_size <= rewind->core_size) return true;
+
+    u8* core = (u8*)realloc(rewind->core, core_size);
+    if (core == NULL) return false;
+    rewind->core = core;
+
+    u8* scratch = (u8*)realloc(rewind->scratch, 2 + PACKED_MAX(core_size) + 2 + BULK_PAGES * (4 + PACKED_MAX(PAGE_SIZE)));
+    if (scratch == NULL) return false;
+    rewind->scratch = scratch;
+
+    rewind->core_size = core_size;
+    return true;
+}
+
+static void drop_front(Rewind* rewind, size_t count){
+    for (size_t i = 0; i < count; i ++){
+        rewind->bytes -= rewind->records[i].size;
+        free(rewind->records[i].data);
+    }
+
+    rewind->count -= count;
+    memmove(rewind->records, rewind->records + count, rewind->count * sizeof(RewindRecord));
+}
+
+static void drop_back(Rewind* rewind, size_t count){
+    /* Keeps the first count records. */
+    while (rewind->count > count){
+        RewindRecord* record = &rewind->records[-- rewind->count];
+        rewind->bytes -= record->size;
+        free(record->data);
+    }
+}
+
+void rewind_free(Rewind* rewind){
+    drop_back(rewind, 0);
+    free(rewind->records);
+    free(rewind->shadow);
+    free(rewind->scratch);
+    free(rewind->core);
+    memset(rewind, 0, sizeof(Rewind));
+}
+
+static size_t encode(Rewind* rewind, Emulator* emu, bool keyframe){
+    /* Builds the record in scratch and brings the shadow up to date. */
+    u8* out = rewind->scratch;
+    u8 diff[PAGE_SIZE];
+    size_t pages = used_pages(emu);
+    size_t core_size = core_state_size(emu);
+    u16 length, count = 0;
+
+    save_core_state(emu, rewind->core);
+    length = pack(rewind->core, core_size, out + 2);
+    memcpy(out, &length, 2);
+    out += 2 + length;
+
+    u8* count_at = out;
+    out += 2;
+
+    for (u16 page = 0; page < pages; page ++){
+        u8* now = emu->vram + page * PAGE_SIZE;
+        u8* before = rewind->shadow + page * PAGE_SIZE;
+
+        if (keyframe) length = pack(now, PAGE_SIZE, out + 4);
+        else {
+            if (!emu->dirty[page]) continue;
+
+            bool changed = false;
+            for (int i = 0; i < PAGE_SIZE; i ++){
+                diff[i] = now[i] ^ before[i];
+                changed |= diff[i] != 0;
+            }
+            if (!changed) continue;
+
+            length = pack(diff, PAGE_SIZE, out + 4);
+        }
+
+        memcpy(out, &page, 2);
+        memcpy(out + 2, &length, 2);
+        out += 4 + length;
+        count ++;
+
+        memcpy(before, now, PAGE_SIZE);
+    }
+
+    memcpy(count_at, &count, 2);
+    memset(emu->dirty, 0, sizeof(emu->dirty));
+
+    return out - rewind->scratch;
+}
+
+bool rewind_capture(Rewind* rewind, Emulator* emu){
+    /* Records the current state. Returns false when out of memory. */
+    if (!reserve(rewind, emu)) return false;
+
+    if (rewind->count == rewind->capacity){
+        size_t capacity = rewind->capacity ? rewind->capacity * 2 : 256;
+        RewindRecord* records = (RewindRecord*)realloc(rewind->records, capacity * sizeof(RewindRecord));
+        if (records == NULL) return false;
+
+        rewind->records = records;
+        rewind->capacity = capacity;
+    }
+
+    bool keyframe = rewind->count == 0 || rewind->force_keyframe || rewind->since_keyframe >= REWIND_KEYFRAME_INTERVAL;
+    size_t size = encode(rewind, emu, keyframe);
+
+    RewindRecord* record = &rewind->records[rewind->count];
+    record->data = (u8*)malloc(size);
+    if (record->data == NULL) return false;
+
+    memcpy(record->data, rewind->scratch, size);
+    record->size = size;
+    record->keyframe = keyframe;
+    record->instructions = emu->instructions;
+
+    rewind->count ++;
+    rewind->bytes += size;
+    rewind->since_keyframe = keyframe ? 1 : rewind->since_keyframe + 1;
+    rewind->force_keyframe = false;
+
+    /* Over budget: drop whole groups from the front, a delta is useless without its keyframe */
+    while (rewind->bytes > rewind->budget){
+        size_t next = 1;
+        while (next < rewind->count && !rewind->records[next].keyframe) next ++;
+
+        if (next == rewind->count){
+            rewind->force_keyframe = true;   /* Only one group left, start another */
+            break;
+        }
+
+        drop_front(rewind, next);
+    }
+
+    return true;
+}
+
+static void apply(Emulator* emu, RewindRecord* record, u8* core){
+    /* Applies the record's pages, and its core state when given somewhere to unpack it. */
+    const u8* in = record->data;
+    u8 page_data[PAGE_SIZE];
+    u16 length, count;
+
+    memcpy(&length, in, 2);
+    if (core != NULL){
+        unpack(in + 2, core, core_state_size(emu));
+        load_core_state(emu, core);
+    }
+    in += 2 + length;
+
+    memcpy(&count, in, 2);
+    in += 2;
+
+    for (u16 n = 0; n < count; n ++){
+        u16 page;
+        memcpy(&page, in, 2);
+        memcpy(&length, in + 2, 2);
+        in += 4;
+
+        u8* target = emu->vram + page * PAGE_SIZE;
+
+        if (record->keyframe) unpack(in, target, PAGE_SIZE);
+        else {
+            unpack(in, page_data, PAGE_SIZE);
+            for (int i = 0; i < PAGE_SIZE; i ++) target[i] ^= page_data[i];
+        }
+
+        in += length;
+    }
+}
+
+bool rewind_restore(Rewind* rewind, Emulator* emu, size_t index){
+    /* Puts emu (the instance that was captured) back to record index and drops every later
+     * record. Decodes the keyframe before it, then the deltas in order. */
+    if (index >= rewind->count || !reserve(rewind, emu)) return false;
+
+    size_t keyframe = index;
+    while (!rewind->records[keyframe].keyframe) keyframe --;
+
+    for (size_t i = keyframe; i <= index; i ++) apply(emu, &rewind->records[i], i == index ? rewind->core : NULL);
+
+    map_memory(emu);
+    memset(emu->dirty, 0, sizeof(emu->dirty));
+    memcpy(rewind->shadow, emu->vram, BULK_SIZE);
+
+    drop_back(rewind, index + 1);
+    rewind->since_keyframe = index - keyframe + 1;
+
+    return true;
+}
+
+bool rewind_frames(Rewind* rewind, Emulator* emu, size_t frames){
+    /* Goes back to the record frames captures before the newest one (0 is the newest). */
+    if (rewind->count == 0) return false;
+    if (frames >= rewind->count) frames = rewind->count - 1;
+
+    return rewind_restore(rewind, emu, rewind->count - 1 - frames);
+}
+
+bool rewind_instructions(Rewind* rewind, Emulator* emu, uint64_t instructions){
+    /* Goes back to the newest record at or before the target instruction and replays from
+     * there. Fails when the target is older than everything still in the buffer. */
+    uint64_t target = instructions < emu->instructions ? emu->instructions - instructions : 0;
+
+    size_t index = rewind->count;
+    while (index > 0 && rewind->records[index - 1].instructions > target) index --;
+    if (index == 0) return false;
+
+    if (!rewind_restore(rewind, emu, index - 1)) return false;
+    Start(emu->cart, emu, UINT64_MAX, target);
+
+    return emu->instructions == target;
+}
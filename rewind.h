@@ -0,0 +1,52 @@
+#ifndef gbc_rewind
+#define gbc_rewind
+
+#include "emulator.h"
+
+/* Rewind buffer: the emulator state captured once per frame (or whenever the owner calls
+ * rewind_capture) into a list bounded by a byte budget. When over budget the oldest
+ * keyframe and its deltas go, so a session can run forever in fixed memory.
+ *
+ * Records are compressed with PackBits:
+ *   keyframe  core state + every bulk memory page in use
+ *   delta     core state + the pages written since the previous record, XORed with their
+ *             previous contents (mostly zeros, which is what compresses)
+ *
+ * Uses emu->dirty, so it cannot share an instance with a SnapshotChain. */
+
+#define DEFAULT_REWIND_BUDGET (64 << 20)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+typedef struct {
+    u8* data;
+    size_t size;
+    bool keyframe;
+    uint64_t instructions;      /* emu->instructions when captured */
+} RewindRecord;
+
+typedef struct {
+    RewindRecord* records;      /* Oldest first */
+    size_t count;
+    size_t capacity;
+
+    size_t budget;              /* Bytes the records may use */
+    size_t bytes;
+    size_t since_keyframe;
+    bool force_keyframe;        /* The current group alone is over budget */
+
+    u8* shadow;                 /* Bulk memory as of the newest record */
+    u8* scratch;                /* One record as it is built */
+    u8* core;                   /* One core state, unpacked */
+    size_t core_size;           /* What scratch and core are sized for */
+} Rewind;
+
+bool rewind_init(Rewind* rewind, size_t budget);
+void rewind_free(Rewind* rewind);
+
+bool rewind_capture(Rewind* rewind, Emulator* emu);
+bool rewind_restore(Rewind* rewind, Emulator* emu, size_t index);
+
+bool rewind_frames(Rewind* rewind, Emulator* emu, size_t frames);
+bool rewind_instructions(Rewind* rewind, Emulator* emu, uint64_t instructions);
+
+#endif
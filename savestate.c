@@ -0,0 +1,173 @@
+#include "savestate.h"
+#include "cpu.h"
+
+/* One walk over the state serves saving, loading and measuring, so the three can never
+ * disagree on the layout. */
+typedef struct {
+    u8* data;           /* NULL when only measuring */
+    size_t size;
+    size_t offset;
+    bool loading;
+} Stream;
+
+static void field(Stream* s, void* value, size_t length){
+    if (s->data != NULL && s->offset + length <= s->size){
+        if (s->loading) memcpy(value, s->data + s->offset, length);
+        else memcpy(s->data + s->offset, value, length);
+    }
+
+    s->offset += length;
+}
+
+#define FIELD(s, x) field(s, &(x), sizeof(x))
+
+static void walk(Stream* s, Emulator* emu, bool bulk){
+    /* Everything, or with bulk false everything except VRAM, WRAM and external RAM (which
+     * snapshot.c stores page by page). */
+    /* CPU */
+    FIELD(s, emu->AF); FIELD(s, emu->BC); FIELD(s, emu->DE);
+    FIELD(s, emu->HL); FIELD(s, emu->SP); FIELD(s, emu->PC);
+    FIELD(s, emu->lazy.op); FIELD(s, emu->lazy.val1); FIELD(s, emu->lazy.val2);
+    FIELD(s, emu->lazy.result); FIELD(s, emu->lazy.carry);
+    FIELD(s, emu->ime); FIELD(s, emu->halted); FIELD(s, emu->error);
+
+    /* Timing */
+    FIELD(s, emu->instructions); FIELD(s, emu->cycles); FIELD(s, emu->halted_cycles);
+    FIELD(s, emu->div_base); FIELD(s, emu->tima_overflow); FIELD(s, emu->lcd_base);
+    FIELD(s, emu->serial_out);
+
+    /* Memory */
+    if (bulk){ FIELD(s, emu->vram); FIELD(s, emu->wram1); FIELD(s, emu->wram2); }
+    FIELD(s, emu->high); FIELD(s, emu->oam);
+
+    /* Scheduler */
+    FIELD(s, emu->scheduler.when); FIELD(s, emu->scheduler.heap);
+    FIELD(s, emu->scheduler.index); FIELD(s, emu->scheduler.size);
+
+    /* Mapper. The sizes come from the cartridge and are not stored. */
+    Mapper* mbc = &emu->mbc;
+    FIELD(s, mbc->ram_enabled); FIELD(s, mbc->rom_bank); FIELD(s, mbc->bank_hi);
+    FIELD(s, mbc->ram_bank); FIELD(s, mbc->mode);
+    FIELD(s, mbc->rtc_seconds); FIELD(s, mbc->rtc_cycle); FIELD(s, mbc->rtc_halted);
+    FIELD(s, mbc->rtc_carry); FIELD(s, mbc->rtc_latch); FIELD(s, mbc->rtc_latched);
+
+    if (bulk) field(s, emu->eram, mbc->ram_size);
+}
+
+static size_t state_size(Emulator* emu, uint32_t ram_size){
+    Stream s = { NULL, 0, 0, false };
+    walk(&s, emu, true);
+
+    return sizeof(SaveStateHeader) + s.offset - emu->mbc.ram_size + ram_size;
+}
+
+size_t savestate_size(Emulator* emu){
+    return state_size(emu, emu->mbc.ram_size);
+}
+
+size_t save_state(Emulator* emu, u8* out, size_t capacity){
+    /* Returns the bytes written, 0 when out is too small (see savestate_size). */
+    size_t size = savestate_size(emu);
+    if (capacity < size) return 0;
+
+    SaveStateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAVESTATE_MAGIC, 4);
+    header.version = SAVESTATE_VERSION;
+    header.size = size;
+    header.rom_hash = cartridge_hash(emu->cart);
+    memcpy(out, &header, sizeof(header));
+
+    Stream s = { out + sizeof(header), size - sizeof(header), 0, false };
+    walk(&s, emu, true);
+
+    return size;
+}
+
+state_error load_state(Emulator* emu, Cartridge* cart, const u8* data, size_t size){
+    /* Puts emu (running cart) back in the saved state. The hooks, trace and user pointer are
+     * kept. Nothing is touched unless the whole state checks out. */
+    SaveStateHeader header;
+    if (size < sizeof(header)) return STATE_TRUNCATED;
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, SAVESTATE_MAGIC, 4) != 0) return STATE_BAD_MAGIC;
+    if (header.version != SAVESTATE_VERSION) return STATE_BAD_VERSION;
+    if (header.rom_hash != cartridge_hash(cart)) return STATE_WRONG_ROM;
+    if (header.size != size || size != state_size(emu, mbc_ram_size(cart))) return STATE_TRUNCATED;
+
+    if (emu->cart != cart){
+        emu->cart = cart;
+        init_mbc(emu);
+    }
+
+    Stream s = { (u8*)data + sizeof(header), size - sizeof(header), 0, true };
+    walk(&s, emu, true);
+
+    emu->run = emu->error == EMU_OK;
+    memset(emu->dirty, 1, sizeof(emu->dirty));
+    ppu_invalidate_tiles(emu);
+    ppu_index_sprites(emu);
+    if (emu->apu.enabled) apu_start(emu);
+    map_memory(emu);
+
+    return STATE_OK;
+}
+
+size_t core_state_size(Emulator* emu){
+    Stream s = { NULL, 0, 0, false };
+    walk(&s, emu, false);
+
+    return s.offset;
+}
+
+void save_core_state(Emulator* emu, u8* out){
+    /* No header and no bulk memory: out has to hold core_state_size bytes. */
+    Stream s = { out, core_state_size(emu), 0, false };
+    walk(&s, emu, false);
+}
+
+void load_core_state(Emulator* emu, const u8* data){
+    /* Counterpart of save_core_state, for the same cartridge. Leaves the page table to the
+     * caller, who restores the bulk memory too: the decoded tiles are thrown away here. */
+    Stream s = { (u8*)data, core_state_size(emu), 0, true };
+    walk(&s, emu, false);
+
+    emu->run = emu->error == EMU_OK;
+    ppu_invalidate_tiles(emu);
+    ppu_index_sprites(emu);
+    if (emu->apu.enabled) apu_start(emu);
+}
+
+bool save_state_file(Emulator* emu, const char* path){
+    size_t size = savestate_size(emu);
+    u8* data = (u8*)malloc(size);
+    if (data == NULL) return false;
+
+    save_state(emu, data, size);
+
+    FILE* file = fopen(path, "wb");
+    bool written = file != NULL && fwrite(data, size, 1, file) == 1;
+    if (file != NULL) written &= fclose(file) == 0;
+
+    free(data);
+    return written;
+}
+
+state_error load_state_file(Emulator* emu, Cartridge* cart, const char* path){
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return STATE_CANNOT_READ;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8* data = size > 0 ? (u8*)malloc(size) : NULL;
+    bool loaded = data != NULL && fread(data, size, 1, file) == 1;
+    fclose(file);
+
+    state_error error = loaded ? load_state(emu, cart, data, size) : STATE_CANNOT_READ;
+    free(data);
+
+    return error;
+}
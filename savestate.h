@@ -0,0 +1,45 @@
+#ifndef gbc_savestate
+#define gbc_savestate
+
+#include "emulator.h"
+
+/* Save states: everything an Emulator needs to carry on exactly where it was, minus the ROM
+ * (referenced by hash) and whatever the owner attached (hooks, trace, cartridge).
+ *
+ * Layout: the header below, then the CPU, timing, memory, scheduler and mapper sections in
+ * that order, scalars in host byte order. Memory regions are stored raw, external RAM only
+ * as large as the cartridge declares. Version 2 added OAM. */
+
+#define SAVESTATE_MAGIC "GBSS"
+#define SAVESTATE_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;          /* Whole state, header included */
+    uint32_t reserved;
+    uint64_t rom_hash;      /* cartridge_hash of the ROM the state was taken on */
+} SaveStateHeader;
+
+typedef enum {
+    STATE_OK,
+    STATE_BAD_MAGIC,
+    STATE_BAD_VERSION,
+    STATE_WRONG_ROM,
+    STATE_TRUNCATED,
+    STATE_CANNOT_READ       /* load_state_file only */
+} state_error;
+
+size_t savestate_size(Emulator* emu);
+size_t save_state(Emulator* emu, u8* out, size_t capacity);
+state_error load_state(Emulator* emu, Cartridge* cart, const u8* data, size_t size);
+
+/* Everything but the bulk memory (VRAM, WRAM, external RAM), headerless, for snapshot.c */
+size_t core_state_size(Emulator* emu);
+void save_core_state(Emulator* emu, u8* out);
+void load_core_state(Emulator* emu, const u8* data);
+
+bool save_state_file(Emulator* emu, const char* path);
+state_error load_state_file(Emulator* emu, Cartridge* cart, const char* path);
+
+#endif
@@ -0,0 +1,87 @@
+#include "scheduler.h"
+
+static void swap_slots(Scheduler* scheduler, u8 a, u8 b){
+    u8 type = scheduler->heap[a];
+
+    scheduler->heap[a] = scheduler->heap[b];
+    scheduler->heap[b] = type;
+
+    scheduler->index[scheduler->heap[a]] = a;
+    scheduler->index[scheduler->heap[b]] = b;
+}
+
+static bool earlier(Scheduler* scheduler, u8 a, u8 b){
+    return scheduler->when[scheduler->heap[a]] < scheduler->when[scheduler->heap[b]];
+}
+
+static void sift_up(Scheduler* scheduler, u8 slot){
+    while (slot > 0 && earlier(scheduler, slot, (slot - 1) / 2)){
+        swap_slots(scheduler, slot, (slot - 1) / 2);
+        slot = (slot - 1) / 2;
+    }
+}
+
+static void sift_down(Scheduler* scheduler, u8 slot){
+    for (;;){
+        u8 smallest = slot;
+        u8 left = slot * 2 + 1;
+        u8 right = slot * 2 + 2;
+
+        if (left < scheduler->size && earlier(scheduler, left, smallest)) smallest = left;
+        if (right < scheduler->size && earlier(scheduler, right, smallest)) smallest = right;
+        if (smallest == slot) return;
+
+        swap_slots(scheduler, slot, smallest);
+        slot = smallest;
+    }
+}
+
+void scheduler_init(Scheduler* scheduler){
+    scheduler->size = 0;
+    memset(scheduler->index, EVENT_NONE, sizeof(scheduler->index));
+}
+
+void schedule_event(Scheduler* scheduler, event_type type, uint64_t when){
+    u8 slot = scheduler->index[type];
+
+    if (slot == EVENT_NONE){
+        slot = scheduler->size ++;
+        scheduler->heap[slot] = type;
+        scheduler->index[type] = slot;
+    }
+
+    scheduler->when[type] = when;
+
+    sift_up(scheduler, slot);
+    sift_down(scheduler, scheduler->index[type]);
+}
+
+void cancel_event(Scheduler* scheduler, event_type type){
+    u8 slot = scheduler->index[type];
+    if (slot == EVENT_NONE) return;
+
+    u8 last = -- scheduler->size;
+    if (slot != last){
+        swap_slots(scheduler, slot, last);
+
+        u8 moved = scheduler->heap[slot];
+        sift_up(scheduler, slot);
+        sift_down(scheduler, scheduler->index[moved]);
+    }
+
+    scheduler->index[type] = EVENT_NONE;
+}
+
+uint64_t next_event(Scheduler* scheduler){
+    return scheduler->size > 0 ? scheduler->when[scheduler->heap[0]] : UINT64_MAX;
+}
+
+u8 pop_due_event(Scheduler* scheduler, uint64_t now){
+    /* Returns the earliest event due at or before now (and unschedules it), or EVENT_NONE. */
+    if (scheduler->size == 0 || scheduler->when[scheduler->heap[0]] > now) return EVENT_NONE;
+
+    u8 type = scheduler->heap[0];
+    cancel_event(scheduler, type);
+
+    return type;
+}
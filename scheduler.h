@@ -0,0 +1,35 @@
+#ifndef gbc_scheduler
+#define gbc_scheduler
+
+#include "common.h"
+
+/* Everything that happens at a known point in emulated time. Each type is pending at most
+ * once, scheduling it again just moves it. */
+typedef enum {
+    EVENT_INTERRUPT,    /* IF, IE or IME changed: check for an interrupt to deliver */
+    EVENT_TIMER,        /* TIMA overflows */
+    EVENT_SERIAL,       /* Serial transfer completes */
+    EVENT_VBLANK,       /* LY reaches 144 */
+    EVENT_STAT,         /* Next LCD mode / LY=LYC change that has its STAT interrupt enabled */
+
+    EVENT_COUNT
+} event_type;
+
+#define EVENT_NONE 0xff
+
+/* Binary min-heap of event types ordered by due cycle. */
+typedef struct {
+    uint64_t when[EVENT_COUNT];   /* Due cycle of each type */
+    u8 heap[EVENT_COUNT];
+    u8 index[EVENT_COUNT];        /* Position of each type in heap, EVENT_NONE when not pending */
+    u8 size;
+} Scheduler;
+
+void scheduler_init(Scheduler* scheduler);
+void schedule_event(Scheduler* scheduler, event_type type, uint64_t when);
+void cancel_event(Scheduler* scheduler, event_type type);
+
+uint64_t next_event(Scheduler* scheduler);
+u8 pop_due_event(Scheduler* scheduler, uint64_t now);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "savestate.h"
+#include "snapshot.h"
+
+/* Snapshot benchmark: runs a ROM frame by frame taking a snapshot after every frame, and
+ * compares the incremental chain against a full save state per frame. */
+
+static double now(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]){
+    if (argc < 2) {
+        printf("Usage: %s <rom> [frames] [keyframe interval]\n", argv[0]);
+        exit(1);
+    }
+
+    int frames = argc > 2 ? atoi(argv[2]) : 600;
+    size_t interval = argc > 3 ? strtoul(argv[3], NULL, 0) : DEFAULT_KEYFRAME_INTERVAL;
+
+    size_t size;
+    uint8_t* memory = mapRom(argv[1], &size);
+    if (memory == NULL) {
+        printf("Cannot open file.\n");
+        exit(10);
+    }
+
+    Cartridge cart;
+    initCartridge(&cart, memory, size);
+    Emulator* emu = createEmulator(&cart);
+
+    SnapshotChain chain;
+    snapshot_chain_init(&chain, interval);
+
+    size_t full_size = savestate_size(emu);
+    u8* full = (u8*)malloc(full_size);
+
+    double full_time = 0, take_time = 0;
+    size_t keyframes = 0, keyframe_bytes = 0, delta_bytes = 0;
+
+    for (int frame = 0; frame < frames && emu->error == EMU_OK; frame ++){
+        emulator_run(emu, CYCLES_PER_FRAME);
+
+        double started = now();
+        save_state(emu, full, full_size);
+        full_time += now() - started;
+
+        started = now();
+        size_t bytes = snapshot_take(&chain, emu);
+        take_time += now() - started;
+
+        if (chain.snapshots[chain.count - 1].keyframe) keyframes ++, keyframe_bytes += bytes;
+        else delta_bytes += bytes;
+    }
+
+    size_t taken = chain.count;
+    size_t deltas = taken - keyframes;
+
+    /* The last snapshot is the slowest kind to restore: the most deltas since a keyframe */
+    int restores = 1000;
+    double started = now();
+    for (int i = 0; i < restores; i ++) snapshot_restore(&chain, emu, taken - 1);
+    double restore_time = now() - started;
+
+    printf("%zu snapshots (%zu keyframes every %zu), %zu bytes in total\n", taken, keyframes, interval, chain.bytes);
+    printf("full state:  %zu bytes, %.2f us per save\n", full_size, full_time / taken * 1e6);
+    printf("keyframe:    %.0f bytes on average\n", keyframes ? (double)keyframe_bytes / keyframes : 0.0);
+    printf("delta:       %.0f bytes on average\n", deltas ? (double)delta_bytes / deltas : 0.0);
+    printf("snapshot:    %.0f bytes, %.2f us on average (%.1f%% of a full state)\n",
+        (double)chain.bytes / taken, take_time / taken * 1e6, 100.0 * chain.bytes / taken / full_size);
+    printf("restore:     %.2f us (last snapshot, %zu deltas after its keyframe)\n",
+        restore_time / restores * 1e6, (taken - 1) % interval);
+
+    snapshot_chain_free(&chain);
+    free(full);
+    destroyEmulator(emu);
+    unmapRom(memory, size);
+
+    return 0;
+}
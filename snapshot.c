@@ -0,0 +1,139 @@
+#include "snapshot.h"
+#include "savestate.h"
+#include "cpu.h"
+
+#define PAGE_SIZE 0x100
+
+_Static_assert(offsetof(Emulator, eram) - offsetof(Emulator, vram) == BULK_SIZE - ERAM_MAX,
+    "bulk memory has to be contiguous for the dirty page index");
+
+void snapshot_chain_init(SnapshotChain* chain, size_t keyframe_interval){
+    memset(chain, 0, sizeof(SnapshotChain));
+    chain->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+}
+
+void snapshot_chain_free(SnapshotChain* chain){
+    snapshot_truncate(chain, 0);
+    free(chain->snapshots);
+    chain->snapshots = NULL;
+    chain->capacity = 0;
+}
+
+void snapshot_truncate(SnapshotChain* chain, size_t count){
+    /* Drops every snapshot from count on. */
+    while (chain->count > count){
+        Snapshot* snapshot = &chain->snapshots[-- chain->count];
+        chain->bytes -= snapshot->size;
+        free(snapshot->data);
+    }
+}
+
+static size_t last_keyframe(SnapshotChain* chain, size_t index){
+    while (!chain->snapshots[index].keyframe) index --;
+    return index;
+}
+
+static bool take_keyframe(Snapshot* snapshot, Emulator* emu){
+    snapshot->size = savestate_size(emu);
+    snapshot->data = (u8*)malloc(snapshot->size);
+    if (snapshot->data == NULL) return false;
+
+    save_state(emu, snapshot->data, snapshot->size);
+    snapshot->keyframe = true;
+
+    return true;
+}
+
+static bool take_delta(Snapshot* snapshot, Emulator* emu){
+    /* Pages of external RAM past what the cartridge has are never written, so every dirty
+     * page is a real one. */
+    uint32_t core = core_state_size(emu);
+    u16 pages = 0;
+
+    for (int page = 0; page < BULK_PAGES; page ++) pages += emu->dirty[page];
+
+    snapshot->size = 4 + core + 2 + pages * (2 + PAGE_SIZE);
+    snapshot->data = (u8*)malloc(snapshot->size);
+    if (snapshot->data == NULL) return false;
+
+    u8* out = snapshot->data;
+    memcpy(out, &core, 4); out += 4;
+    save_core_state(emu, out); out += core;
+    memcpy(out, &pages, 2); out += 2;
+
+    for (u16 page = 0; page < BULK_PAGES; page ++){
+        if (!emu->dirty[page]) continue;
+
+        memcpy(out, &page, 2);
+        memcpy(out + 2, emu->vram + page * PAGE_SIZE, PAGE_SIZE);
+        out += 2 + PAGE_SIZE;
+    }
+
+    snapshot->keyframe = false;
+
+    return true;
+}
+
+size_t snapshot_take(SnapshotChain* chain, Emulator* emu){
+    /* Appends a snapshot of emu, a keyframe when the interval is up. Returns its size in
+     * bytes, 0 when out of memory. */
+    if (chain->count == chain->capacity){
+        size_t capacity = chain->capacity ? chain->capacity * 2 : 64;
+        Snapshot* snapshots = (Snapshot*)realloc(chain->snapshots, capacity * sizeof(Snapshot));
+        if (snapshots == NULL) return 0;
+
+        chain->snapshots = snapshots;
+        chain->capacity = capacity;
+    }
+
+    bool keyframe = chain->count == 0 || chain->count - last_keyframe(chain, chain->count - 1) >= chain->keyframe_interval;
+
+    Snapshot* snapshot = &chain->snapshots[chain->count];
+    if (!(keyframe ? take_keyframe(snapshot, emu) : take_delta(snapshot, emu))) return 0;
+
+    chain->count ++;
+    chain->bytes += snapshot->size;
+    memset(emu->dirty, 0, sizeof(emu->dirty));
+
+    return snapshot->size;
+}
+
+bool snapshot_restore(SnapshotChain* chain, Emulator* emu, size_t index){
+    /* Puts emu back to snapshot index and drops every later one, so the next snapshot taken
+     * continues the chain from there. Loads the keyframe, then walks the deltas back from
+     * index, copying each page only from the newest delta that has it. */
+    if (index >= chain->count) return false;
+
+    size_t keyframe = last_keyframe(chain, index);
+    Snapshot* key = &chain->snapshots[keyframe];
+    if (load_state(emu, emu->cart, key->data, key->size) != STATE_OK) return false;
+
+    u8 seen[BULK_PAGES] = { 0 };
+
+    for (size_t i = index; i > keyframe; i --){
+        const u8* in = chain->snapshots[i].data;
+        uint32_t core;
+        u16 pages;
+
+        memcpy(&core, in, 4);
+        if (i == index) load_core_state(emu, in + 4);
+        in += 4 + core;
+
+        memcpy(&pages, in, 2); in += 2;
+
+        for (u16 n = 0; n < pages; n ++, in += 2 + PAGE_SIZE){
+            u16 page;
+            memcpy(&page, in, 2);
+            if (seen[page]) continue;
+
+            memcpy(emu->vram + page * PAGE_SIZE, in + 2, PAGE_SIZE);
+            seen[page] = 1;
+        }
+    }
+
+    map_memory(emu);
+    memset(emu->dirty, 0, sizeof(emu->dirty));
+    snapshot_truncate(chain, index + 1);
+
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef gbc_snapshot
+#define gbc_snapshot
+
+#include "emulator.h"
+
+/* Incremental snapshots: a chain of full save states (keyframes) each followed by deltas
+ * that only hold the core state and the bulk memory pages written since the snapshot
+ * before them.
+ *
+ * Delta layout: u32 core size, the core state (see save_core_state), u16 page count, then
+ * for every page its u16 index into bulk memory and its 256 bytes. */
+
+#define DEFAULT_KEYFRAME_INTERVAL 60
+
+typedef struct {
+    u8* data;
+    size_t size;
+    bool keyframe;      /* data is a save state, otherwise a delta */
+} Snapshot;
+
+typedef struct {
+    Snapshot* snapshots;
+    size_t count;
+    size_t capacity;
+    size_t keyframe_interval;   /* A keyframe at least every this many snapshots */
+    size_t bytes;               /* Stored in all snapshots together */
+} SnapshotChain;
+
+void snapshot_chain_init(SnapshotChain* chain, size_t keyframe_interval);
+void snapshot_chain_free(SnapshotChain* chain);
+
+size_t snapshot_take(SnapshotChain* chain, Emulator* emu);
+bool snapshot_restore(SnapshotChain* chain, Emulator* emu, size_t index);
+void snapshot_truncate(SnapshotChain* chain, size_t count);
+
+#endif
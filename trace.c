@@ -0,0 +1,114 @@
+#include "trace.h"
+#include "tracefile.h"
+#include "cpu.h"
+
+bool trace_init(Trace* trace, size_t capacity, uint32_t level){
+    /* The whole ring is allocated up front, recording never allocates. */
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    trace->records = (TraceRecord*)calloc(size, sizeof(TraceRecord));
+    trace->capacity = trace->records == NULL ? 0 : size;
+    trace->total = 0;
+    trace->level = level;
+    trace->enabled = false;
+
+    return trace->records != NULL;
+}
+
+void trace_free(Trace* trace){
+    free(trace->records);
+
+    trace->records = NULL;
+    trace->capacity = 0;
+    trace->enabled = false;
+}
+
+void trace_enable(Trace* trace, bool enabled){
+    trace->enabled = enabled && trace->records != NULL;
+}
+
+void trace_record(Trace* trace, Emulator* emu){
+    TraceRecord* record = &trace->records[trace->total & (trace->capacity - 1)];
+    u16 pc = emu->PC.entireByte;
+
+    record->pc = pc;
+    record->opcode[0] = read(emu, pc);
+    record->opcode[1] = read(emu, pc + 1);
+    record->opcode[2] = read(emu, pc + 2);
+
+    resolve_flags(emu);
+    record->af = AF(emu);
+    record->bc = BC(emu);
+    record->de = DE(emu);
+    record->hl = HL(emu);
+    record->sp = emu->SP.entireByte;
+
+    trace->total ++;
+}
+
+void trace_record_pc(Trace* trace, Emulator* emu){
+    trace->records[trace->total & (trace->capacity - 1)].pc = emu->PC.entireByte;
+    trace->total ++;
+}
+
+bool trace_save(Trace* trace, const char* path){
+    /* Writes the ring oldest record first, in the format of tracefile.h. */
+    uint64_t count = trace->total < trace->capacity ? trace->total : trace->capacity;
+    uint64_t first = trace->total - count;
+
+    TraceWriter writer;
+    if (!trace_writer_open(&writer, path, trace->level, first)) return false;
+
+    bool ok = true;
+    for (uint64_t i = first; i < trace->total && ok; i ++) {
+        ok = trace_writer_append(&writer, &trace->records[i & (trace->capacity - 1)]);
+    }
+
+    return trace_writer_close(&writer) && ok;
+}
+
+bool trace_stream(Cartridge* cart, Emulator* emu, Trace* trace, const char* path, uint64_t max_cycles, uint64_t max_instructions){
+    /* Runs like Start, writing every instruction to path as it goes: the emulator runs a ring
+     * at a time and each ring is appended before it can wrap. */
+    TraceWriter writer;
+    if (!trace_writer_open(&writer, path, trace->level, emu->instructions)) return false;
+
+    bool ok = true;
+    trace_enable(trace, true);
+
+    while (ok) {
+        uint64_t begin = trace->total;
+        uint64_t limit = max_instructions - emu->instructions > trace->capacity ? emu->instructions + trace->capacity : max_instructions;
+
+        Start(cart, emu, max_cycles, limit);
+
+        for (uint64_t i = begin; i < trace->total && ok; i ++) {
+            ok = trace_writer_append(&writer, &trace->records[i & (trace->capacity - 1)]);
+        }
+
+        if (trace->total == begin || !emu->run || emu->cycles >= max_cycles || emu->instructions >= max_instructions) break;
+    }
+
+    return trace_writer_close(&writer) && ok;
+}
+
+void trace_print_record(const TraceRecord* record, uint32_t level){
+    /* Same two lines printRegisters and printInstruction produce, so old logs stay comparable. */
+    char out[DISASM_LENGTH];
+    u8 f = record->af & 0xff;
+
+    if (level == TRACE_LEVEL_PC) {
+        printf("[0x%04x]\n", record->pc);
+        return;
+    }
+
+    printf("[A%02x|B%02x|C%02x|D%02x|E%02x|H%02x|L%02x|SP%04x]\n", record->af >> 8,
+        record->bc >> 8, record->bc & 0xff, record->de >> 8, record->de & 0xff,
+        record->hl >> 8, record->hl & 0xff, record->sp);
+
+    printf("[0x%04x][Z%d N%d H%d C%d] %5s", record->pc, f >> 7, (f >> 6) & 1, (f >> 5) & 1, (f >> 4) & 1, "");
+
+    disassemble(record->opcode, out);
+    printf("%s\n", out);
+}
@@ -0,0 +1,64 @@
+#ifndef gbc_trace
+#define gbc_trace
+
+#include "emulator.h"
+
+/* Trace tiers, picked at build time with -DTRACE_LEVEL=n (see the Makefile targets):
+ *  0  off           the hook compiles to nothing
+ *  1  pc            ring records only hold the PC
+ *  2  registers     ring records hold the PC, opcode bytes and every register
+ *  3  disassembly   registers and disassembly are printed live to stdout (the old log format)
+ */
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_PC 1
+#define TRACE_LEVEL_REGISTERS 2
+#define TRACE_LEVEL_DISASSEMBLY 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_OFF
+#endif
+
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+
+/* One executed instruction, as it looked right before dispatch.
+ * Records are a fixed 16 bytes so the ring is a flat array and a dump is a plain fwrite. */
+typedef struct {
+    u16 pc;
+    u8 opcode[3];     /* Bytes at PC, PC + 1 and PC + 2 */
+    u8 reserved;
+
+    u16 af, bc, de, hl, sp;
+} TraceRecord;
+
+struct Trace {
+    TraceRecord* records;
+    size_t capacity;  /* Always a power of two */
+    uint64_t total;   /* Records written since init; the ring holds the last min(total, capacity) */
+    uint32_t level;   /* Tier of the build that records into it */
+
+    bool enabled;
+};
+
+bool trace_init(Trace* trace, size_t capacity, uint32_t level);
+void trace_free(Trace* trace);
+void trace_enable(Trace* trace, bool enabled);
+
+void trace_record(Trace* trace, Emulator* emu);
+void trace_record_pc(Trace* trace, Emulator* emu);
+
+bool trace_save(Trace* trace, const char* path);
+bool trace_stream(Cartridge* cart, Emulator* emu, Trace* trace, const char* path, uint64_t max_cycles, uint64_t max_instructions);
+void trace_print_record(const TraceRecord* record, uint32_t level);
+
+/* The per-instruction hook used by dispatch(). */
+#if TRACE_LEVEL == TRACE_LEVEL_OFF
+#define TRACE_INSTRUCTION(emu)
+#elif TRACE_LEVEL == TRACE_LEVEL_PC
+#define TRACE_INSTRUCTION(emu) if (emu->trace != NULL && emu->trace->enabled) trace_record_pc(emu->trace, emu);
+#elif TRACE_LEVEL == TRACE_LEVEL_REGISTERS
+#define TRACE_INSTRUCTION(emu) if (emu->trace != NULL && emu->trace->enabled) trace_record(emu->trace, emu);
+#else
+#define TRACE_INSTRUCTION(emu) printRegisters(emu); printInstruction(emu);
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#include "tracefile.h"
+#include "lockstep.h"
+
+/* Offline tool for trace files (see tracefile.h):
+ *   dump     turns records back into the text log format, starting at an instruction index
+ *            (found through the checkpoint index, not by reading up to it) and limited to a count
+ *   convert  writes any trace or text log (printRegisters / printInstruction format) as a
+ *            version 2 trace, so reference logs can be archived at a fraction of their size
+ *   info     prints the header */
+
+static void usage(const char* name){
+    printf("Usage: %s <trace file> [first instruction] [count]\n", name);
+    printf("       %s -c <trace file or text log> <output trace file>\n", name);
+    printf("       %s -i <trace file>\n", name);
+}
+
+static int convert(const char* input, const char* output){
+    Reference reference;
+    TraceWriter writer;
+    TraceRecord record;
+
+    if (!reference_open(&reference, input)) {
+        printf("Cannot open file.\n");
+        return 10;
+    }
+
+    /* A text log only shows its tier with the first record */
+    bool any = reference_next(&reference, &record);
+
+    if (!trace_writer_open(&writer, output, reference.level, reference.first)) {
+        printf("Cannot write trace file.\n");
+        reference_close(&reference);
+        return 12;
+    }
+
+    bool ok = true;
+    for (; any && ok; any = reference_next(&reference, &record)) ok = trace_writer_append(&writer, &record);
+
+    ok = trace_writer_close(&writer) && ok;
+    reference_close(&reference);
+
+    if (!ok) {
+        printf("Cannot write trace file.\n");
+        return 12;
+    }
+
+    printf("%llu records, %llu bytes (%.2f per record)\n", (unsigned long long)writer.header.count,
+        (unsigned long long)writer.offset, writer.header.count ? (double)writer.offset / writer.header.count : 0.0);
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    if (argc < 2) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (strcmp(argv[1], "-c") == 0) {
+        if (argc < 4) {
+            usage(argv[0]);
+            exit(1);
+        }
+
+        return convert(argv[2], argv[3]);
+    }
+
+    bool info = strcmp(argv[1], "-i") == 0;
+    const char* path = info ? argv[2] : argv[1];
+
+    TraceReader reader;
+    if (path == NULL || !trace_reader_open(&reader, path)) {
+        printf("Cannot open file (or not a trace file of a supported version).\n");
+        exit(10);
+    }
+
+    TraceFileHeader* header = &reader.header;
+
+    if (info) {
+        printf("version %u, trace level %u\n", header->version, header->level);
+        printf("%llu records from instruction %llu\n", (unsigned long long)header->count, (unsigned long long)header->first);
+        if (header->version > 1) printf("checkpoint every %u records\n", header->checkpoint_interval);
+
+        trace_reader_close(&reader);
+        return 0;
+    }
+
+    uint64_t from = argc > 2 ? strtoull(argv[2], NULL, 0) : header->first;
+    uint64_t limit = argc > 3 ? strtoull(argv[3], NULL, 0) : header->count;
+
+    if (!trace_reader_seek(&reader, from)) {
+        printf("Cannot seek in the trace file.\n");
+        trace_reader_close(&reader);
+        exit(11);
+    }
+
+    TraceRecord record;
+    for (uint64_t i = 0; i < limit && trace_reader_next(&reader, &record); i ++) {
+        trace_print_record(&record, header->level);
+    }
+
+    trace_reader_close(&reader);
+    return 0;
+}
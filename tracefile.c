@@ -0,0 +1,263 @@
+#define _FILE_OFFSET_BITS 64     /* 64-bit off_t for fseeko on 32-bit hosts */
+
+#include "tracefile.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+static const u8 instruction_lengths[0x100] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+};
+
+u8 instruction_length(u8 opcode){
+    /* Opcode plus operands, CB prefixed instructions count as two. */
+    return instruction_lengths[opcode];
+}
+
+static bool has_registers(uint32_t level){
+    return level >= TRACE_LEVEL_REGISTERS;
+}
+
+bool trace_writer_open(TraceWriter* writer, const char* path, uint32_t level, uint64_t first){
+    memset(writer, 0, sizeof(TraceWriter));
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) return false;
+
+    memcpy(writer->header.magic, TRACE_MAGIC, 4);
+    writer->header.version = TRACE_VERSION;
+    writer->header.first = first;
+    writer->header.level = level;
+    writer->header.checkpoint_interval = TRACE_CHECKPOINT_INTERVAL;
+
+    /* Rewritten with the count and index by trace_writer_close */
+    writer->offset = sizeof(TraceFileHeader);
+    if (fwrite(&writer->header, sizeof(TraceFileHeader), 1, writer->file) != 1) {
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool trace_writer_append(TraceWriter* writer, const TraceRecord* record){
+    u8 out[1 + 2 + 5 * 2 + 3];
+    size_t size = 1;
+    u8 mask;
+
+    TraceRecord* last = &writer->last;
+    bool registers = has_registers(writer->header.level);
+    bool checkpoint = writer->header.count % TRACE_CHECKPOINT_INTERVAL == 0;
+
+    if (checkpoint) {
+        if (writer->header.count / TRACE_CHECKPOINT_INTERVAL == writer->capacity) {
+            size_t capacity = writer->capacity ? writer->capacity * 2 : 256;
+            uint64_t* checkpoints = (uint64_t*)realloc(writer->checkpoints, capacity * sizeof(uint64_t));
+            if (checkpoints == NULL) return false;
+
+            writer->checkpoints = checkpoints;
+            writer->capacity = capacity;
+        }
+
+        writer->checkpoints[writer->header.count / TRACE_CHECKPOINT_INTERVAL] = writer->offset;
+    }
+
+    int delta = (int)record->pc - (int)last->pc;
+
+    if (checkpoint || (delta < -128 || delta > 127)) {
+        mask = TRACE_PC_ABSOLUTE;
+        memcpy(out + size, &record->pc, 2);
+        size += 2;
+    } else if (registers && record->pc == (u16)(last->pc + instruction_length(last->opcode[0]))) {
+        mask = TRACE_PC_NEXT;
+    } else {
+        mask = TRACE_PC_DELTA;
+        out[size ++] = (u8)(int8_t)delta;
+    }
+
+    if (registers) {
+#define CHANGED(bit, field) \
+        if (checkpoint || record->field != last->field) { mask |= bit; memcpy(out + size, &record->field, 2); size += 2; }
+
+        CHANGED(TRACE_CHANGED_AF, af);
+        CHANGED(TRACE_CHANGED_BC, bc);
+        CHANGED(TRACE_CHANGED_DE, de);
+        CHANGED(TRACE_CHANGED_HL, hl);
+        CHANGED(TRACE_CHANGED_SP, sp);
+
+#undef CHANGED
+
+        u8 length = instruction_length(record->opcode[0]);
+        memcpy(out + size, record->opcode, length);
+        size += length;
+    }
+
+    out[0] = mask;
+    *last = *record;
+
+    if (fwrite(out, 1, size, writer->file) != size) return false;
+
+    writer->offset += size;
+    writer->header.count ++;
+
+    return true;
+}
+
+bool trace_writer_close(TraceWriter* writer){
+    /* Appends the index and fills in the header. */
+    size_t checkpoints = (writer->header.count + TRACE_CHECKPOINT_INTERVAL - 1) / TRACE_CHECKPOINT_INTERVAL;
+    writer->header.index = writer->offset;
+
+    bool ok = fwrite(writer->checkpoints, sizeof(uint64_t), checkpoints, writer->file) == checkpoints;
+    ok = ok && fseek(writer->file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&writer->header, sizeof(TraceFileHeader), 1, writer->file) == 1;
+    ok = fclose(writer->file) == 0 && ok;
+
+    free(writer->checkpoints);
+    writer->checkpoints = NULL;
+    writer->file = NULL;
+
+    return ok;
+}
+
+static bool seek(FILE* file, uint64_t offset){
+    /* fseek takes a long, which is 32 bits on Windows, and traces run past 2 GB. */
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+bool trace_reader_open(TraceReader* reader, const char* path){
+    memset(reader, 0, sizeof(TraceReader));
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) return false;
+
+    TraceFileHeader* header = &reader->header;
+    bool ok = fread(header, TRACE_V1_HEADER_SIZE, 1, reader->file) == 1 && memcmp(header->magic, TRACE_MAGIC, 4) == 0;
+
+    if (ok && header->version == 1) {
+        header->checkpoint_interval = 0;
+        header->index = 0;
+        return true;
+    }
+
+    ok = ok && header->version == TRACE_VERSION;
+    ok = ok && fread((u8*)header + TRACE_V1_HEADER_SIZE, sizeof(TraceFileHeader) - TRACE_V1_HEADER_SIZE, 1, reader->file) == 1;
+    ok = ok && header->checkpoint_interval > 0;
+
+    if (ok && header->count > 0) {
+        /* An empty trace has no checkpoints, and seeking in it never looks for one */
+        size_t checkpoints = (header->count + header->checkpoint_interval - 1) / header->checkpoint_interval;
+        reader->checkpoints = (uint64_t*)malloc(checkpoints * sizeof(uint64_t));
+
+        ok = reader->checkpoints != NULL && seek(reader->file, header->index);
+        ok = ok && fread(reader->checkpoints, sizeof(uint64_t), checkpoints, reader->file) == checkpoints;
+        ok = ok && seek(reader->file, sizeof(TraceFileHeader));
+    }
+
+    if (!ok) trace_reader_close(reader);
+    return ok;
+}
+
+void trace_reader_close(TraceReader* reader){
+    if (reader->file != NULL) fclose(reader->file);
+    free(reader->checkpoints);
+
+    reader->file = NULL;
+    reader->checkpoints = NULL;
+}
+
+bool trace_reader_seek(TraceReader* reader, uint64_t instruction){
+    /* Positions the reader so the next record is instruction's (clamped to the records in
+     * the file). Jumps to the checkpoint at or before it and decodes forward from there. */
+    TraceFileHeader* header = &reader->header;
+    uint64_t target = instruction > header->first ? instruction - header->first : 0;
+    if (target > header->count) target = header->count;
+
+    if (header->version == 1) {
+        reader->position = target;
+        return seek(reader->file, TRACE_V1_HEADER_SIZE + target * sizeof(TraceRecord));
+    }
+
+    if (target == header->count) {
+        reader->position = target;
+        return true;
+    }
+
+    uint64_t checkpoint = target / header->checkpoint_interval;
+    if (!seek(reader->file, reader->checkpoints[checkpoint])) return false;
+    reader->position = checkpoint * header->checkpoint_interval;
+
+    TraceRecord record;
+    while (reader->position < target) {
+        if (!trace_reader_next(reader, &record)) return false;
+    }
+
+    return true;
+}
+
+bool trace_reader_next(TraceReader* reader, TraceRecord* record){
+    /* Reads the next record. Returns false at the end of the file (or on a short read). */
+    if (reader->position >= reader->header.count) return false;
+
+    if (reader->header.version == 1) {
+        if (fread(record, sizeof(TraceRecord), 1, reader->file) != 1) return false;
+        reader->position ++;
+        return true;
+    }
+
+    TraceRecord* last = &reader->last;
+    FILE* file = reader->file;
+    int mask = getc(file);
+    if (mask == EOF) return false;
+
+    switch (mask & TRACE_PC_MASK) {
+        case TRACE_PC_NEXT: last->pc += instruction_length(last->opcode[0]); break;
+        case TRACE_PC_DELTA: last->pc += (int8_t)getc(file); break;
+        default: if (fread(&last->pc, 2, 1, file) != 1) return false; break;
+    }
+
+#define CHANGED(bit, field) \
+    if ((mask & bit) && fread(&last->field, 2, 1, file) != 1) return false;
+
+    CHANGED(TRACE_CHANGED_AF, af);
+    CHANGED(TRACE_CHANGED_BC, bc);
+    CHANGED(TRACE_CHANGED_DE, de);
+    CHANGED(TRACE_CHANGED_HL, hl);
+    CHANGED(TRACE_CHANGED_SP, sp);
+
+#undef CHANGED
+
+    if (has_registers(reader->header.level)) {
+        memset(last->opcode, 0, sizeof(last->opcode));
+        if (fread(last->opcode, 1, 1, file) != 1) return false;
+
+        u8 operands = instruction_length(last->opcode[0]) - 1;
+        if (operands > 0 && fread(last->opcode + 1, 1, operands, file) != operands) return false;
+    }
+
+    *record = *last;
+    reader->position ++;
+
+    return true;
+}
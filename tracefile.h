@@ -0,0 +1,76 @@
+#ifndef gbc_tracefile
+#define gbc_tracefile
+
+#include "trace.h"
+
+/* Trace files. Version 2 stores every record as the difference from the one before it:
+ *
+ *   u8 mask    TRACE_PC_* in the low two bits, then one bit per register pair that changed
+ *   pc         nothing for TRACE_PC_NEXT (previous PC plus the previous instruction's
+ *              length), an i8 for TRACE_PC_DELTA, a u16 for TRACE_PC_ABSOLUTE
+ *   registers  a u16 for every bit set, AF BC DE HL SP in that order
+ *   opcode     the instruction's bytes, as many as it is long (register tier only)
+ *
+ * Every checkpoint_interval records one is written in full (absolute PC, every register), so
+ * decoding can start there. The index at the end of the file holds the file offset of every
+ * checkpoint, which makes seeking to instruction N one fseek and at most an interval of
+ * records decoded.
+ *
+ * Version 1 files (raw TraceRecords, no index) are still read. Values are host byte order. */
+
+#define TRACE_MAGIC "GBTR"
+#define TRACE_VERSION 2
+#define TRACE_CHECKPOINT_INTERVAL 4096
+
+#define TRACE_PC_NEXT 0
+#define TRACE_PC_DELTA 1
+#define TRACE_PC_ABSOLUTE 2
+#define TRACE_PC_MASK 3
+
+#define TRACE_CHANGED_AF (1 << 2)
+#define TRACE_CHANGED_BC (1 << 3)
+#define TRACE_CHANGED_DE (1 << 4)
+#define TRACE_CHANGED_HL (1 << 5)
+#define TRACE_CHANGED_SP (1 << 6)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;                 /* Records in the file */
+    uint64_t first;                 /* Instruction index of the first record */
+    uint32_t level;                 /* TRACE_LEVEL the records were captured with */
+    uint32_t checkpoint_interval;   /* Reserved in version 1 */
+    uint64_t index;                 /* File offset of the checkpoint index, version 2 only */
+} TraceFileHeader;
+
+#define TRACE_V1_HEADER_SIZE offsetof(TraceFileHeader, index)
+
+typedef struct {
+    FILE* file;
+    TraceFileHeader header;
+    TraceRecord last;
+    uint64_t* checkpoints;          /* File offset of every checkpoint so far */
+    size_t capacity;
+    uint64_t offset;                /* Where the next record goes */
+} TraceWriter;
+
+typedef struct {
+    FILE* file;
+    TraceFileHeader header;
+    TraceRecord last;
+    uint64_t* checkpoints;
+    uint64_t position;              /* Records read (or skipped) so far */
+} TraceReader;
+
+bool trace_writer_open(TraceWriter* writer, const char* path, uint32_t level, uint64_t first);
+bool trace_writer_append(TraceWriter* writer, const TraceRecord* record);
+bool trace_writer_close(TraceWriter* writer);
+
+bool trace_reader_open(TraceReader* reader, const char* path);
+void trace_reader_close(TraceReader* reader);
+bool trace_reader_seek(TraceReader* reader, uint64_t instruction);
+bool trace_reader_next(TraceReader* reader, TraceRecord* record);
+
+u8 instruction_length(u8 opcode);
+
+#endif
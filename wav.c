@@ -0,0 +1,134 @@
+#include <stdlib.h>
+
+#include "wav.h"
+
+#define HEADER_SIZE 44
+
+static void put_u16(u8* out, u16 value){
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+static void put_u32(u8* out, uint32_t value){
+    put_u16(out, value & 0xffff);
+    put_u16(out + 2, value >> 16);
+}
+
+static bool write_header(WavWriter* wav){
+    /* RIFF / fmt / data, little endian whatever the host. Sizes past 4 GB are clamped. */
+    uint64_t bytes = wav->frames * 4;
+    uint32_t data = bytes > 0xFFFFFFFFULL - 36 ? 0xFFFFFFFFUL - 36 : (uint32_t)bytes;
+    u8 header[HEADER_SIZE];
+
+    memcpy(header, "RIFF", 4);
+    put_u32(header + 4, 36 + data);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_u32(header + 16, 16);
+    put_u16(header + 20, 1);                /* PCM */
+    put_u16(header + 22, 2);                /* Stereo */
+    put_u32(header + 24, wav->rate);
+    put_u32(header + 28, wav->rate * 4);
+    put_u16(header + 32, 4);
+    put_u16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put_u32(header + 40, data);
+
+    return fseek(wav->file, 0, SEEK_SET) == 0 && fwrite(header, HEADER_SIZE, 1, wav->file) == 1;
+}
+
+static void* writer(void* arg){
+    /* Writes out whatever is in the ring, the longest contiguous run at a time, without
+     * holding the lock while on the disk */
+    WavWriter* wav = (WavWriter*)arg;
+
+    pthread_mutex_lock(&wav->lock);
+    for (;;){
+        while (wav->count == 0 && !wav->closing) pthread_cond_wait(&wav->filled, &wav->lock);
+        if (wav->count == 0) break;
+
+        size_t run = wav->count < WAV_RING_FRAMES - wav->head ? wav->count : WAV_RING_FRAMES - wav->head;
+        const int16_t* from = wav->ring + wav->head * 2;
+
+        pthread_mutex_unlock(&wav->lock);
+        bool ok = fwrite(from, 4, run, wav->file) == run;
+        pthread_mutex_lock(&wav->lock);
+
+        if (!ok) wav->failed = true;
+        wav->head = (wav->head + run) % WAV_RING_FRAMES;
+        wav->count -= run;
+        wav->frames += run;
+        pthread_cond_signal(&wav->drained);
+    }
+    pthread_mutex_unlock(&wav->lock);
+
+    return NULL;
+}
+
+bool wav_open(WavWriter* wav, const char* path, uint32_t rate){
+    memset(wav, 0, sizeof(WavWriter));
+    wav->rate = rate;
+    wav->ring = (int16_t*)malloc(WAV_RING_FRAMES * 4);
+    wav->file = fopen(path, "wb");
+
+    if (wav->ring == NULL || wav->file == NULL || !write_header(wav)){
+        if (wav->file != NULL) fclose(wav->file);
+        free(wav->ring);
+        return false;
+    }
+
+    pthread_mutex_init(&wav->lock, NULL);
+    pthread_cond_init(&wav->filled, NULL);
+    pthread_cond_init(&wav->drained, NULL);
+
+    if (pthread_create(&wav->thread, NULL, writer, wav) != 0){
+        fclose(wav->file);
+        free(wav->ring);
+        return false;
+    }
+
+    return true;
+}
+
+void wav_write(WavWriter* wav, const int16_t* samples, size_t count){
+    /* Queues count stereo pairs, the samples are little endian on every host this builds on */
+    pthread_mutex_lock(&wav->lock);
+
+    while (count > 0){
+        while (wav->count == WAV_RING_FRAMES) pthread_cond_wait(&wav->drained, &wav->lock);
+
+        size_t tail = (wav->head + wav->count) % WAV_RING_FRAMES;
+        size_t room = WAV_RING_FRAMES - wav->count;
+        size_t run = WAV_RING_FRAMES - tail;
+
+        if (run > room) run = room;
+        if (run > count) run = count;
+
+        memcpy(wav->ring + tail * 2, samples, run * 4);
+        wav->count += run;
+        samples += run * 2;
+        count -= run;
+        pthread_cond_signal(&wav->filled);
+    }
+
+    pthread_mutex_unlock(&wav->lock);
+}
+
+bool wav_close(WavWriter* wav){
+    /* Waits for the ring to drain, then fills in the header */
+    pthread_mutex_lock(&wav->lock);
+    wav->closing = true;
+    pthread_cond_signal(&wav->filled);
+    pthread_mutex_unlock(&wav->lock);
+
+    pthread_join(wav->thread, NULL);
+
+    bool ok = !wav->failed && write_header(wav);
+    ok = fclose(wav->file) == 0 && ok;
+
+    pthread_mutex_destroy(&wav->lock);
+    pthread_cond_destroy(&wav->filled);
+    pthread_cond_destroy(&wav->drained);
+    free(wav->ring);
+
+    return ok;
+}
@@ -0,0 +1,36 @@
+#ifndef gbc_wav
+#define gbc_wav
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "common.h"
+
+/* Streaming WAV writer (16-bit stereo PCM). Samples are copied into a ring and written to the
+ * file by a background thread, so the emulator only waits on the disk when the ring is full.
+ * The header's sizes are filled in by wav_close. */
+
+#define WAV_RING_FRAMES (1 << 16)   /* Stereo pairs, about 1.4 s at 48 kHz */
+
+typedef struct {
+    FILE* file;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      /* Samples came in, or closing */
+    pthread_cond_t drained;     /* Room came free */
+
+    int16_t* ring;
+    size_t head;                /* Next pair to write to the file */
+    size_t count;               /* Pairs waiting */
+    bool closing;
+    bool failed;
+
+    uint32_t rate;
+    uint64_t frames;            /* Pairs written to the file */
+} WavWriter;
+
+bool wav_open(WavWriter* wav, const char* path, uint32_t rate);
+void wav_write(WavWriter* wav, const int16_t* samples, size_t count);
+bool wav_close(WavWriter* wav);
+
+#endif